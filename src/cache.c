@@ -0,0 +1,321 @@
+/*
+ * cache.c -- shared cache of the name lookups
+ * Part of the GNU netcat project
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "netcat.h"
+#include <fcntl.h>		/* open(2), fcntl(2) record locks */
+#include <time.h>		/* time(2) for the expiration times */
+#include <sys/stat.h>		/* fstat() */
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>		/* mmap() */
+#endif
+
+/* Netcat processes launched in a row tend to look up the same hostnames and
+   service names over and over.  The cache file keeps the answers of the
+   forward and reverse lookups and of the services database, each with its
+   own expiration time, so that they can be shared by all the netcat
+   processes using the same file (see `--cache').
+
+   The file is mapped in memory and holds a fixed size hash table with open
+   addressing: a key is only searched in NETCAT_CACHE_PROBES consecutive
+   slots, and when all of them are taken the one expiring first is replaced.
+   Writers are serialized with a record lock on the file, while readers never
+   lock anything: each slot is protected by a sequence counter, which is odd
+   while the slot is being written, so that a reader just copies the slot and
+   tries again if the counter changed meanwhile.  The layout depends on the
+   host, the file is not meant to be moved to a different architecture. */
+
+#define CACHE_MAGIC "NCCA"
+#define CACHE_VERSION 1
+#define CACHE_KEYLEN 112
+#define CACHE_VALLEN 128
+
+typedef struct {
+  char magic[4];
+  unsigned short version;
+  unsigned short slot_size;	/* sizeof(cache_slot_t) */
+  unsigned int slots;		/* number of slots in the table */
+  unsigned int reserved[5];
+} cache_header_t;
+
+typedef struct {
+  unsigned int seq;		/* sequence counter, odd while writing */
+  unsigned char type;		/* nc_cache_t, 0 for a free slot */
+  unsigned char key_len;
+  unsigned short value_len;
+  unsigned int hash;		/* hash of the type and the key */
+  unsigned int expires;		/* expiration time, seconds since the Epoch */
+  char key[CACHE_KEYLEN];
+  unsigned char value[CACHE_VALLEN];
+} cache_slot_t;
+
+/* Full memory barrier, so that the sequence counters are never reordered with
+   the slots contents */
+#ifdef __GNUC__
+# define cache_barrier() __sync_synchronize()
+#else
+# define cache_barrier()
+#endif
+
+static int cache_fd = -1;
+static cache_header_t *cache_map = NULL;
+static volatile cache_slot_t *cache_slots = NULL;
+static size_t cache_size = 0;
+
+/* Takes (`type' F_WRLCK) or releases (F_UNLCK) the writers lock */
+
+static bool cache_lock(int type)
+{
+  struct flock fl;
+
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  while (fcntl(cache_fd, F_SETLKW, &fl) < 0)
+    if (errno != EINTR)
+      return FALSE;
+  return TRUE;
+}
+
+/* FNV-1a hash of the type and the key */
+
+static unsigned int cache_hash(nc_cache_t type, const char *key)
+{
+  unsigned int hash = 2166136261U;
+
+  hash = (hash ^ type) * 16777619U;
+  while (*key)
+    hash = (hash ^ (unsigned char)*key++) * 16777619U;
+  return hash;
+}
+
+/* Opens the cache file `filename', creating it if it doesn't exist yet.
+   Returns TRUE on success, FALSE if the file can't be opened or is not a
+   valid cache file (an error message is printed in this case). */
+
+bool netcat_cache_open(const char *filename)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+  struct stat st;
+  size_t size = sizeof(cache_header_t) +
+		NETCAT_CACHE_SLOTS * sizeof(cache_slot_t);
+  void *map;
+
+  if ((cache_fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0) {
+    ncprint(NCPRINT_ERROR, _("Failed to open cache file: %s (%s)"), filename,
+	    strerror(errno));
+    return FALSE;
+  }
+
+  /* a new file is initialized by the first process getting the lock */
+  if (!cache_lock(F_WRLCK) || (fstat(cache_fd, &st) < 0))
+    goto err;
+  if ((st.st_size == 0) && (ftruncate(cache_fd, size) < 0))
+    goto err;
+  if (st.st_size != 0)
+    size = st.st_size;
+
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache_fd, 0);
+  if (map == MAP_FAILED)
+    goto err;
+  cache_map = map;
+  cache_size = size;
+
+  if (st.st_size == 0) {
+    memcpy(cache_map->magic, CACHE_MAGIC, 4);
+    cache_map->version = CACHE_VERSION;
+    cache_map->slot_size = sizeof(cache_slot_t);
+    cache_map->slots = NETCAT_CACHE_SLOTS;
+  }
+  else if ((size < sizeof(cache_header_t)) ||
+	   memcmp(cache_map->magic, CACHE_MAGIC, 4) ||
+	   (cache_map->version != CACHE_VERSION) ||
+	   (cache_map->slot_size != sizeof(cache_slot_t)) ||
+	   (cache_map->slots == 0) ||
+	   (size != sizeof(cache_header_t) + cache_map->slots * sizeof(cache_slot_t))) {
+    cache_lock(F_UNLCK);
+    ncprint(NCPRINT_ERROR, _("Invalid cache file: %s"), filename);
+    netcat_cache_close();
+    return FALSE;
+  }
+  cache_lock(F_UNLCK);
+
+  cache_slots = (volatile cache_slot_t *)(cache_map + 1);
+  debug_v(("netcat_cache_open(): %u slots", cache_map->slots));
+  return TRUE;
+
+ err:
+  ncprint(NCPRINT_ERROR, _("Failed to open cache file: %s (%s)"), filename,
+	  strerror(errno));
+  netcat_cache_close();
+  return FALSE;
+#else
+  ncprint(NCPRINT_ERROR, _("The lookups cache is not supported on this system"));
+  return FALSE;
+#endif
+}
+
+/* Unmaps and closes the cache file, if any */
+
+void netcat_cache_close(void)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+  if (cache_map)
+    munmap((void *)cache_map, cache_size);
+#endif
+  if (cache_fd >= 0)
+    close(cache_fd);
+  cache_map = NULL;
+  cache_slots = NULL;
+  cache_fd = -1;
+}
+
+/* Copies the slot `slot' into `dst', making sure that it was not being
+   written meanwhile.  Returns FALSE if a writer kept it busy too long (or
+   died while writing it). */
+
+static bool cache_read(volatile cache_slot_t *slot, cache_slot_t *dst)
+{
+  int tries;
+
+  for (tries = 0; tries < 100; tries++) {
+    unsigned int seq = slot->seq;
+
+    if (seq & 1)
+      continue;
+    cache_barrier();
+    memcpy(dst, (const void *)slot, sizeof(*dst));
+    cache_barrier();
+    if (slot->seq == seq)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Looks up the entry of type `type' for the key `key'.  Up to `size' bytes of
+   its value are copied in `value', which may be NULL if only the presence of
+   the entry matters.  Returns the number of bytes copied, or -1 if there is
+   no valid entry (or no cache at all). */
+
+int netcat_cache_get(nc_cache_t type, const char *key, void *value,
+		     size_t size)
+{
+  size_t key_len = strlen(key);
+  unsigned int i, hash, now;
+
+  if (!cache_slots || (key_len >= CACHE_KEYLEN))
+    return -1;
+
+  hash = cache_hash(type, key);
+  now = (unsigned int)time(NULL);
+  for (i = 0; i < NETCAT_CACHE_PROBES; i++) {
+    cache_slot_t slot;
+
+    if (!cache_read(&cache_slots[(hash + i) % cache_map->slots], &slot))
+      continue;
+    if (slot.type == 0)		/* slots are never freed: end of the chain */
+      break;
+    if ((slot.hash != hash) || (slot.type != type) ||
+	(slot.key_len != key_len) || memcmp(slot.key, key, key_len))
+      continue;
+
+    if ((slot.expires <= now) || (slot.value_len > CACHE_VALLEN))
+      break;
+    if (slot.value_len < size)
+      size = slot.value_len;
+    if (value)
+      memcpy(value, slot.value, size);
+    return size;
+  }
+  return -1;
+}
+
+/* Looks up the addresses of the host `name', and copies them in `iaddrs'
+   (MAXINETADDRS of them at most) unless it is NULL.  The slots are shared
+   with the other processes, so a value that isn't a list of addresses is
+   just a miss.  Returns the number of addresses, or 0 if there is no valid
+   entry. */
+
+int netcat_cache_get_addrs(const char *name, struct in_addr *iaddrs)
+{
+  struct in_addr buf[MAXINETADDRS];
+  int ret;
+
+  ret = netcat_cache_get(NETCAT_CACHE_HOST, name, buf, sizeof(buf));
+  if ((ret <= 0) || (ret % sizeof(buf[0])))
+    return 0;
+  if (iaddrs)
+    memcpy(iaddrs, buf, ret);
+  return ret / sizeof(buf[0]);
+}
+
+/* Stores the value `value' of `len' bytes for the key `key' of type `type',
+   valid for `ttl' seconds.  Keys and values too long for the slots, or
+   lifetimes past the range of the expiration time, are just not cached. */
+
+void netcat_cache_put(nc_cache_t type, const char *key, const void *value,
+		      size_t len, unsigned long ttl)
+{
+  size_t key_len = strlen(key);
+  unsigned int i, hash, now, seq;
+  volatile cache_slot_t *slot = NULL;
+
+  if (!cache_slots || (key_len >= CACHE_KEYLEN) || (len > CACHE_VALLEN) ||
+      (ttl > UINT_MAX - (unsigned int)time(NULL)) || !cache_lock(F_WRLCK))
+    return;
+
+  /* reuse the slot of the same key, or else a free or expired one, or else
+     the one that would expire first */
+  hash = cache_hash(type, key);
+  now = (unsigned int)time(NULL);
+  for (i = 0; i < NETCAT_CACHE_PROBES; i++) {
+    volatile cache_slot_t *cur = &cache_slots[(hash + i) % cache_map->slots];
+
+    if ((cur->type == type) && (cur->hash == hash) &&
+	(cur->key_len == key_len) && !memcmp((const void *)cur->key, key, key_len)) {
+      slot = cur;
+      break;
+    }
+    if (!slot || ((slot->type != 0) && (slot->expires > now) &&
+		  ((cur->type == 0) || (cur->expires < slot->expires))))
+      slot = cur;
+    if (cur->type == 0)
+      break;
+  }
+
+  /* odd sequence counter while writing, even again when done.  A previous
+     writer may have died in the middle, so the counter may be odd already */
+  seq = slot->seq | 1;
+  slot->seq = seq;
+  cache_barrier();
+  slot->type = type;
+  slot->key_len = key_len;
+  slot->value_len = len;
+  slot->hash = hash;
+  slot->expires = now + ttl;
+  memcpy((void *)slot->key, key, key_len);
+  memcpy((void *)slot->value, value, len);
+  cache_barrier();
+  slot->seq = seq + 1;
+
+  cache_lock(F_UNLCK);
+}
@@ -0,0 +1,576 @@
+/*
+ * dns.c -- asynchronous DNS resolver (built-in UDP client)
+ * Part of the GNU netcat project
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "netcat.h"
+#include <fcntl.h>		/* fcntl(), open() */
+
+/* The system resolver can only answer one question at a time, and blocks the
+   caller until the answer comes.  This is a minimal DNS client that sends its
+   queries to a single recursive server (set with `--dns-server') over UDP,
+   so that many queries can be in flight at the same time and the answers
+   are processed from the main event loops, through netcat_dns_fd() and
+   netcat_dns_process().
+
+   Each query is kept in a table until it completes.  Queries started with a
+   callback are removed once the callback has run, while the ones started by
+   netcat_dns_prefetch() stay in the table as a cache for the synchronous
+   lookups of netcat_resolvehost(). */
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_PTR 12
+#define DNS_CLASS_IN 1
+#define DNS_RCODE_NXDOMAIN 3
+
+/* Status of a query */
+#define DNS_PENDING 0
+#define DNS_ANSWERED 1
+#define DNS_FAILED 2
+
+typedef struct {
+  char qname[MAXHOSTNAMELEN];	/* name queried (in-addr.arpa for PTR) */
+  unsigned short qtype;
+  unsigned short id;		/* 16 bits query id */
+  int status;
+  int tries;			/* queries sent so far */
+  unsigned long long deadline;	/* when to send the query again (usec) */
+  nc_dns_cb_t cb;		/* callback, or NULL for a cached query */
+  void *arg;			/* callback argument */
+  struct in_addr addrs[MAXINETADDRS]; /* addresses (A) or queried address */
+  int naddrs;
+  char name[MAXHOSTNAMELEN];	/* answer of a PTR query */
+  unsigned long ttl;		/* smallest TTL of the answer records */
+} dns_query_t;
+
+static int dns_fd = -1;
+static dns_query_t *dns_table = NULL;
+static int dns_size = 0;		/* allocated entries */
+static int dns_count = 0;		/* used entries */
+static int dns_pending = 0;		/* queries waiting for an answer */
+static int dns_random_fd = -1;		/* source of the query ids */
+
+/* Sets up the resolver to use the recursive DNS server `server', in the form
+   "address[:port]".  Returns TRUE on success, FALSE if the address is not
+   valid or the socket can't be created (an error message is printed). */
+
+bool netcat_dns_init(const char *server)
+{
+  struct sockaddr_in addr;
+  char buf[NETCAT_ADDRSTRLEN], *port;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(53);
+
+  strncpy(buf, server, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  if ((port = strchr(buf, ':'))) {
+    long num;
+
+    *port++ = 0;
+    num = strtol(port, &port, 10);
+    if (*port || (num < 1) || (num > 65535))
+      goto bad_server;
+    addr.sin_port = htons((unsigned short)num);
+  }
+  if (netcat_inet_pton(AF_INET, buf, &addr.sin_addr) <= 0)
+    goto bad_server;
+
+  /* a connected socket only gets the answers of our server */
+  if (dns_fd >= 0)
+    close(dns_fd);
+  if (((dns_fd = socket(PF_INET, SOCK_DGRAM, 0)) < 0) ||
+      (connect(dns_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+      (fcntl(dns_fd, F_SETFL, O_NONBLOCK) < 0)) {
+    ncprint(NCPRINT_ERROR, _("Couldn't create the DNS socket: %s"),
+	    strerror(errno));
+    return FALSE;
+  }
+
+  /* the answers end up in the cache shared by the other processes, so the
+     query ids must not be guessed by whoever tries to forge them */
+  if ((dns_random_fd < 0) &&
+      ((dns_random_fd = open("/dev/urandom", O_RDONLY)) < 0)) {
+    ncprint(NCPRINT_ERROR, _("Couldn't open /dev/urandom: %s"),
+	    strerror(errno));
+    return FALSE;
+  }
+  return TRUE;
+
+ bad_server:
+  ncprint(NCPRINT_ERROR, _("Invalid DNS server: %s"), server);
+  return FALSE;
+}
+
+/* Returns TRUE if the built-in resolver is in use */
+
+bool netcat_dns_enabled(void)
+{
+  return (dns_fd >= 0);
+}
+
+/* Returns the descriptor to be watched for reading by the event loops, or -1
+   if there is no query waiting for an answer. */
+
+int netcat_dns_fd(void)
+{
+  return (dns_pending > 0 ? dns_fd : -1);
+}
+
+/* Returns the time (usec) when netcat_dns_process() must be called even if
+   no answer arrived, to send the queries again, or 0 if there is none. */
+
+unsigned long long netcat_dns_timeout(void)
+{
+  unsigned long long first = 0;
+  int i;
+
+  for (i = 0; i < dns_count; i++)
+    if ((dns_table[i].status == DNS_PENDING) &&
+	(!first || (dns_table[i].deadline < first)))
+      first = dns_table[i].deadline;
+  return first;
+}
+
+/* Sends (again) the query `q' to the server */
+
+static void dns_send(dns_query_t *q)
+{
+  unsigned char pkt[12 + MAXHOSTNAMELEN + 6];
+  const char *label = q->qname;
+  int len = 12;
+
+  memset(pkt, 0, 12);
+  pkt[0] = q->id >> 8;
+  pkt[1] = q->id & 0xFF;
+  pkt[2] = 0x01;		/* recursion desired */
+  pkt[5] = 1;			/* one question */
+
+  /* the name is encoded as a sequence of length-prefixed labels */
+  while (*label) {
+    const char *dot = strchr(label, '.');
+    int llen = (dot ? dot - label : (int)strlen(label));
+
+    if ((llen == 0) || (llen > 63) || (len + llen + 6 >= (int)sizeof(pkt)))
+      break;
+    pkt[len++] = llen;
+    memcpy(pkt + len, label, llen);
+    len += llen;
+    label += llen + (dot ? 1 : 0);
+  }
+  pkt[len++] = 0;
+  pkt[len++] = 0;
+  pkt[len++] = q->qtype;
+  pkt[len++] = 0;
+  pkt[len++] = DNS_CLASS_IN;
+
+  q->tries++;
+  q->deadline = netcat_time_usec() + NETCAT_DNS_TIMEOUT * 1000000ULL;
+  if (send(dns_fd, pkt, len, 0) < 0) {
+    debug_v(("dns_send(): %s", strerror(errno)));
+  }
+}
+
+/* Returns the random id of a new query (RFC 5452).  Nothing is kept aside,
+   so that the processes forked after netcat_dns_init() don't draw the same
+   ids. */
+
+static unsigned short dns_newid(void)
+{
+  unsigned short id;
+
+  if (read(dns_random_fd, &id, sizeof(id)) != (ssize_t)sizeof(id))
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("Couldn't read /dev/urandom: %s"), strerror(errno));
+  return id;
+}
+
+/* Starts a new query for `qname' of type `qtype'.  Returns the new entry, or
+   NULL if the name is not valid. */
+
+static dns_query_t *dns_start(const char *qname, unsigned short qtype,
+			      nc_dns_cb_t cb, void *arg)
+{
+  dns_query_t *q;
+
+  if (!qname[0] || (strlen(qname) >= sizeof(q->qname)))
+    return NULL;
+
+  if (dns_count == dns_size) {
+    dns_size = (dns_size ? dns_size * 2 : 16);
+    dns_table = realloc(dns_table, dns_size * sizeof(*dns_table));
+  }
+  q = &dns_table[dns_count++];
+  memset(q, 0, sizeof(*q));
+  strcpy(q->qname, qname);
+  q->qtype = qtype;
+  q->id = dns_newid();
+  q->status = DNS_PENDING;
+  q->cb = cb;
+  q->arg = arg;
+  dns_pending++;
+
+  dns_send(q);
+  return q;
+}
+
+/* Finds the cached query for `qname' of type `qtype' */
+
+static dns_query_t *dns_find(const char *qname, unsigned short qtype)
+{
+  int i;
+
+  for (i = 0; i < dns_count; i++)
+    if (!dns_table[i].cb && (dns_table[i].qtype == qtype) &&
+	!strcasecmp(dns_table[i].qname, qname))
+      return &dns_table[i];
+  return NULL;
+}
+
+/* Builds the in-addr.arpa name for the reverse lookup of `addr' */
+
+static void dns_ptrname(char *buf, size_t size, struct in_addr addr)
+{
+  unsigned long a = ntohl(addr.s_addr);
+
+  snprintf(buf, size, "%lu.%lu.%lu.%lu.in-addr.arpa", a & 0xFF,
+	   (a >> 8) & 0xFF, (a >> 16) & 0xFF, (a >> 24) & 0xFF);
+}
+
+/* Starts the lookup of the addresses of `name'.  When the answer comes, or
+   the query fails, the callback `cb' is called with `arg' from
+   netcat_dns_process().  Returns 0 on success, -1 if the name is invalid. */
+
+int netcat_dns_query(const char *name, nc_dns_cb_t cb, void *arg)
+{
+  assert(cb);
+  return (dns_start(name, DNS_TYPE_A, cb, arg) ? 0 : -1);
+}
+
+/* Starts the reverse lookup of the address `addr', see netcat_dns_query() */
+
+int netcat_dns_query_ptr(struct in_addr addr, nc_dns_cb_t cb, void *arg)
+{
+  char qname[32];
+  dns_query_t *q;
+
+  assert(cb);
+  dns_ptrname(qname, sizeof(qname), addr);
+  if (!(q = dns_start(qname, DNS_TYPE_PTR, cb, arg)))
+    return -1;
+  q->addrs[0] = addr;
+  q->naddrs = 1;
+  return 0;
+}
+
+/* Starts the lookup of the addresses of `name' in the background, so that a
+   later netcat_resolvehost() call finds the answer at once.  Many names can
+   be prefetched at the same time and then waited for with
+   netcat_dns_wait(). */
+
+void netcat_dns_prefetch(const char *name)
+{
+  if (!dns_find(name, DNS_TYPE_A) &&
+      !netcat_cache_get_addrs(name, NULL))
+    dns_start(name, DNS_TYPE_A, NULL, NULL);
+}
+
+/* Skips the (possibly compressed) domain name at `p' in the message `msg' of
+   `len' bytes.  If `out' is not NULL, the name is also decoded there.
+   Returns the position after the name, or NULL if it is malformed. */
+
+static const unsigned char *dns_name(const unsigned char *msg, int len,
+				     const unsigned char *p, char *out,
+				     size_t outsize)
+{
+  const unsigned char *next = NULL;
+  size_t olen = 0;
+  int jumps = 0;
+
+  while (TRUE) {
+    if (p >= msg + len)
+      return NULL;
+    if (*p == 0) {
+      p++;
+      break;
+    }
+    if ((*p & 0xC0) == 0xC0) {	/* compression pointer */
+      if ((p + 1 >= msg + len) || (++jumps > 16))
+	return NULL;
+      if (!next)
+	next = p + 2;
+      p = msg + (((p[0] & 0x3F) << 8) | p[1]);
+      continue;
+    }
+    if (p + 1 + *p > msg + len)
+      return NULL;
+    if (out && (olen + *p + 2 < outsize)) {
+      if (olen)
+	out[olen++] = '.';
+      memcpy(out + olen, p + 1, *p);
+      olen += *p;
+    }
+    p += 1 + *p;
+  }
+
+  if (out)
+    out[olen] = 0;
+  return (next ? next : p);
+}
+
+/* Parses the answer `msg' of `len' bytes and completes the matching query.
+   Answers that don't match any pending query are ignored. */
+
+static void dns_answer(const unsigned char *msg, int len)
+{
+  const unsigned char *p, *end = msg + len;
+  unsigned short id;
+  int i, ancount;
+  dns_query_t *q = NULL;
+
+  if (len < 12)
+    return;
+  id = (msg[0] << 8) | msg[1];
+  for (i = 0; i < dns_count; i++)
+    if ((dns_table[i].id == id) && (dns_table[i].status == DNS_PENDING)) {
+      q = &dns_table[i];
+      break;
+    }
+  if (!q || !(msg[2] & 0x80) || (((msg[4] << 8) | msg[5]) != 1))
+    return;			/* unknown id, not an answer, or bogus */
+
+  /* the question must be ours too */
+  {
+    char qname[MAXHOSTNAMELEN];
+
+    if (!(p = dns_name(msg, len, msg + 12, qname, sizeof(qname))) ||
+	(p + 4 > end) || strcasecmp(qname, q->qname) ||
+	(((p[0] << 8) | p[1]) != q->qtype))
+      return;
+    p += 4;
+  }
+
+  q->status = DNS_FAILED;
+  if ((msg[3] & 0x0F) != 0) {
+    debug_v(("dns_answer(%s): rcode=%d", q->qname, msg[3] & 0x0F));
+    goto done;
+  }
+
+  ancount = (msg[6] << 8) | msg[7];
+  for (i = 0; (i < ancount) && p; i++) {
+    unsigned short type, rdlen;
+    unsigned long ttl;
+
+    if (!(p = dns_name(msg, len, p, NULL, 0)) || (p + 10 > end))
+      break;
+    type = (p[0] << 8) | p[1];
+    ttl = ((unsigned long)p[4] << 24) | ((unsigned long)p[5] << 16) |
+	  ((unsigned long)p[6] << 8) | p[7];
+    /* a TTL with the high bit set means zero (RFC 2181) */
+    if (ttl & 0x80000000UL)
+      ttl = 0;
+    else if (ttl > NETCAT_DNS_MAX_TTL)
+      ttl = NETCAT_DNS_MAX_TTL;
+    rdlen = (p[8] << 8) | p[9];
+    p += 10;
+    if (p + rdlen > end)
+      break;
+
+    /* the CNAME records are followed by the records of the canonical name,
+       so they can be just ignored */
+    if ((type == DNS_TYPE_A) && (q->qtype == DNS_TYPE_A) && (rdlen == 4) &&
+	(q->naddrs < MAXINETADDRS)) {
+      memcpy(&q->addrs[q->naddrs++], p, 4);
+      q->status = DNS_ANSWERED;
+    }
+    else if ((type == DNS_TYPE_PTR) && (q->qtype == DNS_TYPE_PTR) &&
+	     (q->status != DNS_ANSWERED) &&
+	     dns_name(msg, len, p, q->name, sizeof(q->name)))
+      q->status = DNS_ANSWERED;
+    else
+      ttl = q->ttl;
+    if (!q->ttl || (ttl < q->ttl))
+      q->ttl = ttl;
+    p += rdlen;
+  }
+
+  /* the answers are shared with the other processes through the cache.  The
+     PTR records are not checked with a direct lookup, so they are kept apart
+     from the verified names of the system resolver */
+  if ((q->status == DNS_ANSWERED) && (q->qtype == DNS_TYPE_A))
+    netcat_cache_put(NETCAT_CACHE_HOST, q->qname, q->addrs,
+		     q->naddrs * sizeof(q->addrs[0]), q->ttl);
+  else if (q->status == DNS_ANSWERED)
+    netcat_cache_put(NETCAT_CACHE_DNSPTR,
+		     netcat_inet_ntop(AF_INET, &q->addrs[0]), q->name,
+		     strlen(q->name), q->ttl);
+
+ done:
+  dns_pending--;
+}
+
+/* Runs the callbacks of the completed queries, and removes them */
+
+static void dns_complete(void)
+{
+  int i = 0;
+
+  while (i < dns_count) {
+    dns_query_t q;
+
+    if ((dns_table[i].status == DNS_PENDING) || !dns_table[i].cb) {
+      i++;
+      continue;
+    }
+
+    /* the callback may start new queries, so it gets a copy */
+    memcpy(&q, &dns_table[i], sizeof(q));
+    memmove(&dns_table[i], &dns_table[i + 1],
+	    (dns_count - i - 1) * sizeof(*dns_table));
+    dns_count--;
+
+    if (q.status == DNS_ANSWERED)
+      q.cb(q.arg, q.addrs, q.naddrs,
+	   (q.qtype == DNS_TYPE_PTR ? q.name : q.qname));
+    else
+      q.cb(q.arg, q.addrs, 0, NULL);
+  }
+}
+
+/* Reads all the answers waiting on the DNS socket, sends again the queries
+   that timed out (or gives them up) and runs the callbacks of the completed
+   queries.  This never blocks. */
+
+void netcat_dns_process(void)
+{
+  unsigned char buf[1500];
+  unsigned long long now;
+  int i, len;
+
+  if (dns_fd < 0)
+    return;
+
+  while ((len = recv(dns_fd, buf, sizeof(buf), 0)) != -1)
+    dns_answer(buf, len);
+
+  now = netcat_time_usec();
+  for (i = 0; i < dns_count; i++) {
+    dns_query_t *q = &dns_table[i];
+
+    if ((q->status != DNS_PENDING) || (now < q->deadline))
+      continue;
+    if (q->tries > NETCAT_DNS_RETRIES) {
+      debug_v(("netcat_dns_process(): %s timed out", q->qname));
+      q->status = DNS_FAILED;
+      dns_pending--;
+    }
+    else
+      dns_send(q);
+  }
+
+  dns_complete();
+}
+
+/* Waits until all the pending queries are completed */
+
+void netcat_dns_wait(void)
+{
+  while (dns_pending > 0) {
+    unsigned long long now = netcat_time_usec(), when = netcat_dns_timeout();
+    struct timeval tt;
+    fd_set ins;
+
+    FD_ZERO(&ins);
+    FD_SET(dns_fd, &ins);
+    tt.tv_sec = (when > now ? (when - now) / 1000000 : 0);
+    tt.tv_usec = (when > now ? (when - now) % 1000000 : 0);
+    if ((select(dns_fd + 1, &ins, NULL, NULL, &tt) < 0) && (errno != EINTR))
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT, "Critical system request failed: %s",
+	      strerror(errno));
+    netcat_dns_process();
+  }
+}
+
+/* Resolves `name' with the built-in resolver, waiting for the answer unless
+   it was prefetched already, and fills `dst' like netcat_resolvehost() does.
+   The name is taken as authoritative, since no reverse lookup is done.
+   Returns TRUE on success, FALSE if the name couldn't be resolved. */
+
+bool netcat_dns_resolve(nc_host_t *dst, const char *name)
+{
+  dns_query_t *q;
+  int i;
+
+  netcat_dns_prefetch(name);
+  if (!(q = dns_find(name, DNS_TYPE_A)))
+    return FALSE;
+  if (q->status == DNS_PENDING) {
+    netcat_dns_wait();
+    q = dns_find(name, DNS_TYPE_A);
+  }
+  if (q->status != DNS_ANSWERED)
+    return FALSE;
+
+  strncpy(dst->host.name, name, MAXHOSTNAMELEN - 1);
+  for (i = 0; i < q->naddrs; i++) {
+    memcpy(&dst->host.iaddrs[i], &q->addrs[i], sizeof(dst->host.iaddrs[0]));
+    strncpy(dst->host.addrs[i], netcat_inet_ntop(AF_INET, &q->addrs[i]),
+	    sizeof(dst->host.addrs[0]));
+  }
+  return TRUE;
+}
+
+/* Looks up the name of the address `addr' with the built-in resolver, and
+   stores it in `name' (which must be MAXHOSTNAMELEN bytes long).  The names
+   answered to the earlier processes are taken from the cache.
+   Returns TRUE on success, FALSE if the address has no name. */
+
+bool netcat_dns_resolve_ptr(char *name, struct in_addr addr)
+{
+  char qname[32];
+  dns_query_t *q;
+  int len;
+
+  len = netcat_cache_get(NETCAT_CACHE_DNSPTR, netcat_inet_ntop(AF_INET, &addr),
+			 name, MAXHOSTNAMELEN - 1);
+  if (len >= 0) {
+    name[len] = 0;
+    return TRUE;
+  }
+
+  dns_ptrname(qname, sizeof(qname), addr);
+  if (!(q = dns_find(qname, DNS_TYPE_PTR))) {
+    q = dns_start(qname, DNS_TYPE_PTR, NULL, NULL);
+    q->addrs[0] = addr;
+    q->naddrs = 1;
+  }
+  if (q->status == DNS_PENDING) {
+    netcat_dns_wait();
+    q = dns_find(qname, DNS_TYPE_PTR);
+  }
+  if (q->status != DNS_ANSWERED)
+    return FALSE;
+
+  strncpy(name, q->name, MAXHOSTNAMELEN - 1);
+  name[MAXHOSTNAMELEN - 1] = 0;
+  return TRUE;
+}
@@ -0,0 +1,184 @@
+/*
+ * framing.c -- datagram boundaries over the stream side
+ * Part of the GNU netcat project
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "netcat.h"
+
+/* A pipe or a stream socket doesn't keep the boundaries of the datagrams, so
+   with `--framing' they are marked in the data.  In line mode each datagram
+   is a line, and the newline is not part of it.  In length mode each
+   datagram follows its length, as a 16 bits number in network byte order,
+   which is the framing of DNS over TCP (RFC 1035).  An empty datagram means
+   EOF to the other side, so the empty records are skipped. */
+
+/* Largest UDP payload.  A longer line is split, a longer record dropped. */
+#define FRAMING_RECORD_MAX 65507
+
+/* The buffer always fits a whole record and its length */
+#define FRAMING_BUFSIZE (2 * NETCAT_DGRAM_MAX)
+
+void netcat_framer_init(nc_framer_t *fr)
+{
+  fr->buf = malloc(FRAMING_BUFSIZE);
+  fr->pos = fr->len = 0;
+  fr->eof = FALSE;
+}
+
+void netcat_framer_free(nc_framer_t *fr)
+{
+  free(fr->buf);
+  fr->buf = NULL;
+}
+
+/* Reads more data from `fd', after moving the pending data to the beginning
+   of the buffer.  The records returned so far are no longer valid.
+   Returns the value returned by read(2). */
+
+ssize_t netcat_framer_fill(nc_framer_t *fr, int fd)
+{
+  ssize_t ret;
+
+  if (fr->pos > 0) {
+    memmove(fr->buf, fr->buf + fr->pos, fr->len - fr->pos);
+    fr->len -= fr->pos;
+    fr->pos = 0;
+  }
+
+  ret = read(fd, fr->buf + fr->len, FRAMING_BUFSIZE - fr->len);
+  if (ret > 0)
+    fr->len += ret;
+  else if (ret == 0)
+    fr->eof = TRUE;
+  return ret;
+}
+
+/* Finds the next complete record in the data read so far, storing its
+   position in `data' and `len'.  After EOF the last line is returned even
+   without its newline, while a truncated record is discarded.
+   Returns TRUE if a record was found, FALSE if more data is needed. */
+
+bool netcat_framer_next(nc_framer_t *fr, unsigned char **data, size_t *len)
+{
+  while (fr->pos < fr->len) {
+    unsigned char *p = fr->buf + fr->pos;
+    size_t avail = fr->len - fr->pos;
+
+    if (opt_framing == NETCAT_FRAMING_LINE) {
+      unsigned char *nl = memchr(p, '\n', avail);
+
+      if (nl) {
+	*len = nl - p;
+	fr->pos += *len + 1;
+      }
+      else if (fr->eof || (avail >= FRAMING_RECORD_MAX)) {
+	*len = (avail > FRAMING_RECORD_MAX ? FRAMING_RECORD_MAX : avail);
+	fr->pos += *len;
+      }
+      else
+	return FALSE;
+      *data = p;
+    }
+    else {
+      size_t rec_len = (avail < 2 ? 0 : (p[0] << 8) | p[1]);
+
+      if ((avail < 2) || (avail < 2 + rec_len)) {
+	if (fr->eof) {
+	  ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+		  _("Discarding a truncated record of %d bytes"), (int)avail);
+	  fr->pos = fr->len;
+	}
+	return FALSE;
+      }
+      fr->pos += 2 + rec_len;
+      if (rec_len > FRAMING_RECORD_MAX) {
+	ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+		_("Discarding a record of %d bytes, too long for a datagram"),
+		(int)rec_len);
+	continue;
+      }
+      *data = p + 2;
+      *len = rec_len;
+    }
+
+    if (*len > 0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Fills `iov' with the datagram `data' of `len' bytes and its framing.  The
+   length is stored in `hdr', which must fit 2 bytes and stay valid as long as
+   `iov' is used.
+   Returns the number of vectors used, at most 2. */
+
+int netcat_framing_iov(struct iovec *iov, unsigned char *hdr, void *data,
+		       size_t len)
+{
+  static char newline[] = "\n";
+  int n = 0;
+
+  if (opt_framing == NETCAT_FRAMING_LEN) {
+    hdr[0] = (len >> 8) & 0xFF;
+    hdr[1] = len & 0xFF;
+    iov[n].iov_base = hdr;
+    iov[n++].iov_len = 2;
+  }
+  iov[n].iov_base = data;
+  iov[n++].iov_len = len;
+  if (opt_framing == NETCAT_FRAMING_LINE) {
+    iov[n].iov_base = newline;
+    iov[n++].iov_len = 1;
+  }
+  return n;
+}
+
+/* Writes the datagram `data' of `len' bytes to `fd' with its framing.  A
+   single writev(2) call is tried first, so the datagrams written by several
+   processes to the same pipe don't get mixed.
+   Returns `len' on success or -1 on error (errno is set). */
+
+int netcat_framing_write(int fd, const void *data, size_t len)
+{
+  struct iovec iov[2], *cur = iov;
+  unsigned char hdr[2];
+  int n = netcat_framing_iov(iov, hdr, (void *)data, len);
+
+  while (n > 0) {
+    ssize_t ret = writev(fd, cur, n);
+
+    if (ret < 0) {
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    while ((n > 0) && ((size_t)ret >= cur->iov_len)) {
+      ret -= cur->iov_len;
+      cur++;
+      n--;
+    }
+    if (n > 0) {
+      cur->iov_base = (char *)cur->iov_base + ret;
+      cur->iov_len -= ret;
+    }
+  }
+  return len;
+}
@@ -27,6 +27,7 @@
 #endif
 
 #include "netcat.h"
+#include <time.h>		/* clock_gettime() */
 
 /* This function takes a binary string and converts its endlines to the
    specified ones.  It also adds a NUL character at the end of the string,
@@ -194,6 +195,26 @@ int netcat_snprintnum(char *str, size_t size, unsigned long number)
   return snprintf(str, size, "%lu%c", number, *p);
 }
 
+/* Returns the current time in microseconds.  The value is taken from a
+   monotonic clock when available, so it is only meaningful when compared
+   against other values returned by this function. */
+
+unsigned long long netcat_time_usec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+  {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000ULL + tv.tv_usec;
+  }
+}
+
 /* prints statistics to stderr with the right verbosity level.  If `force' is
    TRUE, then the verbosity level is overridden and the statistics are printed
    anyway. */
@@ -218,6 +239,15 @@ void netcat_printstats(bool force)
   ncprint(NCPRINT_NONEWLINE | (force ? 0 : NCPRINT_VERB2),
 	  _("Total received bytes: %s\nTotal sent bytes: %s\n"),
 	  str_recv, str_sent);
+  /* the rate is relative to all the datagrams that reached us */
+  if (dgrams_dropped > 0)
+    ncprint(force ? 0 : NCPRINT_VERB2,
+	    _("Total dropped datagrams: %lu (%.2f%% of %lu)"), dgrams_dropped,
+	    100.0 * dgrams_dropped / (dgrams_recv + dgrams_dropped),
+	    dgrams_recv + dgrams_dropped);
+  if (dgrams_toobig > 0)
+    ncprint(force ? 0 : NCPRINT_VERB2,
+	    _("Total datagrams too big for the path MTU: %lu"), dgrams_toobig);
 }
 
 /* This is a safe string split function.  It will return a valid pointer
@@ -299,24 +329,53 @@ void netcat_printhelp(char *argv0)
   printf("\n");
   printf(_("Mandatory arguments to long options are mandatory for short options too.\n"));
   printf(_("Options:\n"
-"  -4, --ipv4                 select IPv4 protocol family\n"
-"  -6, --ipv6                 select IPv6 protocol family\n"
+"  -4, --ipv4                 use only the IPv4 protocol family\n"
+"  -6, --ipv6                 use only the IPv6 protocol family\n"
+"      --banner[=NUM]         print up to NUM bytes sent by open ports (implies -z)\n"
+"      --cache=FILE           cache the name and service lookups in FILE\n"
 "  -c, --close                close connection on EOF from stdin\n"
+"      --dns-server=ADDR[:PORT]\n"
+"                             resolve names concurrently with this DNS server\n"
 "  -e, --exec=PROGRAM         program to exec after connect\n"
+"      --format=csv|json      print the scan results with latency in this format\n"
+"      --framing=line|len     UDP: one datagram per line, or per record after\n"
+"                             its 16 bits length, on the stream side\n"
 "  -g, --gateway=LIST         source-routing hop point[s], up to 8\n"
 "  -G, --pointer=NUM          source-routing pointer: 4, 8, 12, ...\n"
 "  -h, --help                 display this help and exit\n"
-"  -i, --interval=SECS        delay interval for lines sent, ports scanned\n"));
+"  -i, --interval=SECS        delay interval for lines sent, ports scanned\n"
+"      --join=[SOURCE@]GROUP  UDP listen mode: join the multicast GROUP (only\n"
+"                             for SOURCE), may be repeated\n"));
   printf(_(""
 "  -K, --keepalive            enable TCP keepalive\n"
 "  -l, --listen               listen mode, for inbound connects\n"
 "  -L, --tunnel=ADDRESS:PORT  forward local port to remote address\n"
+"      --mcast-if=ADDRESS     local address of the multicast interface\n"
+"      --mcast-ttl=NUM        TTL of the multicast datagrams sent\n"
 "  -n, --dont-resolve         numeric-only IP addresses, no DNS\n"
 "  -N, --convert=CRLF|CR|LF   treat data as ASCII and perform this conversion\n"
 "  -o, --output=FILE          output hexdump traffic to FILE (implies -x)\n"
 "  -p, --local-port=NUM       local port number\n"
+"      --parallel=NUM         concurrent probes when scanning (default: 64)\n"
+"      --pmtu                 UDP: don't fragment, and size the datagrams read\n"
+"                             from stdin to the path MTU\n"
+"      --probes=FILE          load the UDP scan payloads from FILE\n"
 "  -r, --randomize            randomize local and remote ports\n"
-"  -s, --source=ADDRESS       local source address (ip or hostname)\n"));
+"      --rate=NUM[:BURST]     max probes sent per second when scanning, in\n"
+"                             bursts of up to BURST probes (default: 1)\n"
+"      --rcvbuf=SIZE          size of the socket receive buffers, in bytes\n"
+"                             (K and M suffixes allowed)\n"
+"      --reset                close scan probes with a RST (no TIME_WAIT)\n"
+"      --retries=NUM          resends of unanswered UDP/SYN probes (default: 2)\n"
+"      --sessions[=IDLE]      UDP listen mode: serve many peers, forgetting\n"
+"                             the idle ones after IDLE seconds (default: 60)\n"
+"      --since=AGE            recheck only open ports and results older than\n"
+"                             AGE (e.g. 12h), reporting only the changes\n"
+"  -s, --source=ADDRESS       local source address (ip or hostname), may be\n"
+"                             repeated to rotate the sources of scan probes\n"
+"      --state-file=FILE      keep the scan results in FILE\n"
+"      --syn                  half-open scan with raw SYN packets (implies -z)\n"
+"      --target-list=FILE     check the \"host:port\" targets listed in FILE\n"));
 #ifndef USE_OLD_COMPAT
   printf(_(""
 "  -t, --tcp                  TCP mode (default)\n"
@@ -333,10 +392,14 @@ void netcat_printhelp(char *argv0)
 "  -V, --version              output version information and exit\n"
 "  -x, --hexdump              hexdump incoming and outgoing traffic\n"
 "  -w, --wait=SECS            timeout for connects and final net reads\n"
+"      --workers=NUM          UDP listen with `-z' or `--sessions': share the\n"
+"                             local port among NUM processes\n"
 "  -z, --zero                 zero-I/O mode (used for scanning)\n"));
   printf("\n");
   printf(_("Remote port number can also be specified as range.  "
 	   "Example: '1-1024'\n"));
+  printf(_("Hostname can also be an address range or list for scanning.  "
+	   "Example: '10.0.0.0/22,10.1.0.1-254'\n"));
   printf("\n");
 }
 
@@ -30,6 +30,7 @@
 #include <signal.h>
 #include <getopt.h>
 #include <time.h>		/* time(2) used as random seed */
+#include <fcntl.h>		/* open(2) for the targets list */
 
 FILE *output_fp = NULL;		/* output fd (FIXME: i don't like this) */
 bool use_stdin = TRUE;		/* tells wether stdin was closed or not */
@@ -48,14 +49,55 @@ bool opt_random = FALSE;	/* use random ports */
 bool opt_telnet = FALSE;	/* answer in telnet mode */
 bool opt_hexdump = FALSE;	/* hexdump traffic */
 bool opt_zero = FALSE;		/* zero I/O mode (don't expect anything) */
+bool opt_reset = FALSE;		/* close scan probes with a RST */
+bool opt_syn = FALSE;		/* half-open scan with raw SYNs */
 int opt_interval = 0;		/* delay (in seconds) between lines/ports */
 int opt_wait = 0;		/* wait time */
+int opt_parallel = 0;		/* concurrent probes when scanning */
+int opt_rate = 0;		/* max probes per second (0 = unlimited) */
+int opt_burst = 0;		/* max probes sent at once within the rate */
+int opt_retries = NETCAT_UDP_RETRIES; /* retransmissions of UDP probes */
+int opt_banner = 0;		/* bytes of banner to grab (0 = disabled) */
+int opt_sessions = 0;		/* UDP sessions idle time (0 = single peer) */
+int opt_workers = 1;		/* processes sharing the UDP listen port */
+long opt_since = -1;		/* incremental scan age (-1 = disabled) */
 char *opt_outputfile = NULL;	/* hexdump output file */
 char *opt_exec = NULL;		/* program to exec after connecting */
+char *opt_targetlist = NULL;	/* file with a "host:port" target per line */
+char *opt_statefile = NULL;	/* persistent scan results */
+nc_format_t opt_format = NETCAT_FORMAT_TEXT; /* format of the scan results */
+nc_framing_t opt_framing = NETCAT_FRAMING_NONE; /* datagrams on the stream side */
 nc_domain_t opt_domain = NETCAT_DOMAIN_IPV4;
+bool opt_anyfamily = TRUE;	/* connect to IPv4 and IPv6 addresses */
 nc_proto_t opt_proto = NETCAT_PROTO_TCP; /* protocol to use for connections */
 nc_convert_t opt_ascii_conversion = NETCAT_CONVERT_NONE;
 
+/* Identifiers for the options that have no short form.  They are kept out of
+   the chars range so that they can't clash with the short options. */
+enum {
+  OPT_BANNER = 256,
+  OPT_CACHE,
+  OPT_DNSSERVER,
+  OPT_FORMAT,
+  OPT_FRAMING,
+  OPT_JOIN,
+  OPT_MCASTIF,
+  OPT_MCASTTTL,
+  OPT_PARALLEL,
+  OPT_PMTU,
+  OPT_PROBES,
+  OPT_RATE,
+  OPT_RCVBUF,
+  OPT_RESET,
+  OPT_RETRIES,
+  OPT_SESSIONS,
+  OPT_SINCE,
+  OPT_STATEFILE,
+  OPT_SYN,
+  OPT_TARGETLIST,
+  OPT_WORKERS
+};
+
 /* Signal handling */
 
 static void got_term(int z)
@@ -97,7 +139,7 @@ static void got_usr1(int z)
 
 /* Execute an external file making its stdin/stdout/stderr the actual socket */
 
-static void ncexec(nc_sock_t *ncsock)
+void ncexec(nc_sock_t *ncsock)
 {
   int saved_stderr;
   char *p;
@@ -129,12 +171,28 @@ static void ncexec(nc_sock_t *ncsock)
 	  opt_exec, strerror(errno));
 }				/* end of ncexec() */
 
+/* Resolves the remote host `name' into `dst'.  For TCP connections the IPv6
+   addresses are looked up as well, since core_connect() races all the
+   addresses of both the families.
+   Returns TRUE if at least one address was found. */
+
+static bool resolve_remote(nc_host_t *dst, const char *name)
+{
+  bool ret = netcat_resolvehost(dst, name);
+
+  if ((opt_proto == NETCAT_PROTO_TCP) &&
+      (opt_anyfamily || (opt_domain == NETCAT_DOMAIN_IPV6)))
+    ret = netcat_resolvehost6(dst, name) || ret;
+  return ret;
+}
+
 /* main: handle command line arguments and listening status */
 
 int main(int argc, char *argv[])
 {
   int c, glob_ret = EXIT_FAILURE;
   int total_ports, left_ports, accept_ret = -1, connect_ret = -1;
+  int worker = -1;
   bool opt_debug = FALSE;
   int opt_verbose = 0;
   struct sigaction sv;
@@ -146,6 +204,7 @@ int main(int argc, char *argv[])
   nc_sock_t connect_sock;
   nc_sock_t stdio_sock;
   nc_ports_t old_flag = NULL;
+  nc_targets_t remote_targets = NULL;
 
   memset(&local_port, 0, sizeof(local_port));
   memset(&local_host, 0, sizeof(local_host));
@@ -185,26 +244,46 @@ int main(int argc, char *argv[])
   while (TRUE) {
     int option_index = 0;
     static const struct option long_options[] = {
+	{ "banner",	optional_argument,	NULL, OPT_BANNER },
+	{ "cache",	required_argument,	NULL, OPT_CACHE },
 	{ "close",	no_argument,		NULL, 'c' },
 	{ "debug",	no_argument,		NULL, 'd' },
+	{ "dns-server",	required_argument,	NULL, OPT_DNSSERVER },
 	{ "exec",	required_argument,	NULL, 'e' },
+	{ "format",	required_argument,	NULL, OPT_FORMAT },
+	{ "framing",	required_argument,	NULL, OPT_FRAMING },
 	{ "gateway",	required_argument,	NULL, 'g' },
 	{ "pointer",	required_argument,	NULL, 'G' },
 	{ "help",	no_argument,		NULL, 'h' },
 	{ "interval",	required_argument,	NULL, 'i' },
+	{ "join",	required_argument,	NULL, OPT_JOIN },
 	{ "ipv4",	no_argument,		NULL, '4' },
 	{ "ipv6",	no_argument,		NULL, '6' },
 	{ "keepalive",	no_argument,		NULL, 'K' },
 	{ "listen",	no_argument,		NULL, 'l' },
+	{ "mcast-if",	required_argument,	NULL, OPT_MCASTIF },
+	{ "mcast-ttl",	required_argument,	NULL, OPT_MCASTTTL },
 	{ "tunnel",	required_argument,	NULL, 'L' },
 	{ "dont-resolve", no_argument,		NULL, 'n' },
 	{ "convert",	required_argument,	NULL, 'N' }, /* FIXME: proposal: A Ascii? */
 	{ "output",	required_argument,	NULL, 'o' },
+	{ "parallel",	required_argument,	NULL, OPT_PARALLEL },
+	{ "pmtu",	no_argument,		NULL, OPT_PMTU },
 	{ "local-port",	required_argument,	NULL, 'p' },
 	{ "tunnel-port", required_argument,	NULL, 'P' },
+	{ "probes",	required_argument,	NULL, OPT_PROBES },
 	{ "randomize",	no_argument,		NULL, 'r' },
+	{ "rate",	required_argument,	NULL, OPT_RATE },
+	{ "rcvbuf",	required_argument,	NULL, OPT_RCVBUF },
+	{ "reset",	no_argument,		NULL, OPT_RESET },
+	{ "retries",	required_argument,	NULL, OPT_RETRIES },
+	{ "sessions",	optional_argument,	NULL, OPT_SESSIONS },
+	{ "since",	required_argument,	NULL, OPT_SINCE },
 	{ "source",	required_argument,	NULL, 's' },
+	{ "state-file",	required_argument,	NULL, OPT_STATEFILE },
+	{ "syn",	no_argument,		NULL, OPT_SYN },
 	{ "tunnel-source", required_argument,	NULL, 'S' },
+	{ "target-list", required_argument,	NULL, OPT_TARGETLIST },
 #ifndef USE_OLD_COMPAT
 	{ "tcp",	no_argument,		NULL, 't' },
 	{ "telnet",	no_argument,		NULL, 'T' },
@@ -217,6 +296,7 @@ int main(int argc, char *argv[])
 	{ "version",	no_argument,		NULL, 'V' },
 	{ "hexdump",	no_argument,		NULL, 'x' },
 	{ "wait",	required_argument,	NULL, 'w' },
+	{ "workers",	required_argument,	NULL, OPT_WORKERS },
 	{ "zero",	no_argument,		NULL, 'z' },
 	{ 0, 0, 0, 0 }
     };
@@ -229,9 +309,11 @@ int main(int argc, char *argv[])
     switch (c) {
     case '4':			/* don't use IPv6 protocol */
       opt_domain = NETCAT_DOMAIN_IPV4;
+      opt_anyfamily = FALSE;
       break;
     case '6':			/* use IPv6 protocol */
       opt_domain = NETCAT_DOMAIN_IPV6;
+      opt_anyfamily = FALSE;
       break;
     case 'c':			/* close connection on EOF from stdin */
       opt_eofclose = TRUE;
@@ -258,6 +340,37 @@ int main(int argc, char *argv[])
 	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
 		_("Invalid interval time \"%s\""), optarg);
       break;
+    case OPT_JOIN:		/* join a multicast group in listen mode */
+      {
+	nc_mcast_t *m = &sockopts.join[sockopts.joins];
+	char *group, *pbuf = strdup(optarg);
+
+	if (sockopts.joins == NETCAT_MCAST_MAX)
+	  ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		  _("Too many multicast groups (max %d)"), NETCAT_MCAST_MAX);
+	memset(m, 0, sizeof(*m));
+	/* a source-specific membership is written as SOURCE@GROUP */
+	if ((group = strchr(pbuf, '@')))
+	  *group++ = 0;
+	else
+	  group = pbuf;
+	if ((netcat_inet_pton(AF_INET, group, &m->group) <= 0) ||
+	    !IN_MULTICAST(ntohl(m->group.s_addr)))
+	  ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		  _("Invalid multicast group: %s"), group);
+	if ((group != pbuf) &&
+	    (netcat_inet_pton(AF_INET, pbuf, &m->source) <= 0))
+	  ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		  _("Invalid multicast source: %s"), pbuf);
+	free(pbuf);
+#ifndef IP_ADD_SOURCE_MEMBERSHIP
+	if (m->source.s_addr)
+	  ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		  _("Source-specific multicast is not supported on this system"));
+#endif
+	sockopts.joins++;
+      }
+      break;
     case 'K':
       sockopts.keepalive = TRUE;
       break;
@@ -296,7 +409,7 @@ int main(int argc, char *argv[])
 	}
 
 	/* lookup the remote address and the remote port for tunneling */
-	if (!netcat_resolvehost(&connect_sock.remote, pbuf))
+	if (!resolve_remote(&connect_sock.remote, pbuf))
 	  ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
 		  _("Couldn't resolve tunnel target host: %s"), pbuf);
 	if (!netcat_getport(&connect_sock.port, div, 0))
@@ -325,6 +438,17 @@ int main(int argc, char *argv[])
 		_("Invalid conversion specified: %s"), optarg);
       }
       break;
+    case OPT_MCASTIF:		/* interface of the multicast datagrams */
+      if (netcat_inet_pton(AF_INET, optarg, &sockopts.mcast_if) <= 0)
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Invalid multicast interface address: %s"), optarg);
+      break;
+    case OPT_MCASTTTL:		/* TTL of the multicast datagrams */
+      sockopts.mcast_ttl = atoi(optarg);
+      if ((sockopts.mcast_ttl <= 0) || (sockopts.mcast_ttl > 255))
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Invalid multicast TTL: %s"), optarg);
+      break;
     case 'n':			/* numeric-only, no DNS lookups */
       opt_numeric = TRUE;
       break;
@@ -342,20 +466,165 @@ int main(int argc, char *argv[])
 	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
 		_("Invalid tunnel connect port: %s"), optarg);
       break;
+    case OPT_BANNER:		/* grab the banners of the open ports */
+      opt_banner = (optarg ? atoi(optarg) : NETCAT_BANNER_SIZE);
+      if (opt_banner <= 0)
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Invalid banner size: %s"), optarg);
+      opt_zero = TRUE;		/* implied */
+      break;
+    case OPT_CACHE:		/* lookups cache shared by all processes */
+      if (!netcat_cache_open(optarg))
+	exit(EXIT_FAILURE);
+      break;
+    case OPT_DNSSERVER:		/* built-in asynchronous resolver */
+      if (!netcat_dns_init(optarg))
+	exit(EXIT_FAILURE);
+      break;
+    case OPT_FORMAT:		/* format of the scan results */
+      if (!strcasecmp(optarg, "text"))
+	opt_format = NETCAT_FORMAT_TEXT;
+      else if (!strcasecmp(optarg, "csv"))
+	opt_format = NETCAT_FORMAT_CSV;
+      else if (!strcasecmp(optarg, "json"))
+	opt_format = NETCAT_FORMAT_JSON;
+      else
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Invalid results format: %s"), optarg);
+      break;
+    case OPT_FRAMING:		/* datagram boundaries on the stream side */
+      if (!strcasecmp(optarg, "line"))
+	opt_framing = NETCAT_FRAMING_LINE;
+      else if (!strcasecmp(optarg, "len"))
+	opt_framing = NETCAT_FRAMING_LEN;
+      else
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Invalid framing: %s"), optarg);
+      break;
+    case OPT_PARALLEL:		/* concurrent probes when scanning */
+      opt_parallel = atoi(optarg);
+      if (opt_parallel <= 0)
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Invalid number of parallel probes: %s"), optarg);
+      break;
+    case OPT_PMTU:		/* size the datagrams to the path MTU */
+      sockopts.pmtu = TRUE;
+      break;
+    case OPT_PROBES:		/* custom payloads for the UDP scanner */
+      if (!netcat_probes_load(optarg))
+	exit(EXIT_FAILURE);
+      break;
     case 'r':			/* randomize various things */
       opt_random = TRUE;
       break;
-    case 's':			/* local source address */
-      /* lookup the source address and assign it to the connection address */
-      if (!netcat_resolvehost(&local_host, optarg))
+    case OPT_RATE:		/* max probes per second when scanning */
+      {
+	char *endptr;
+
+	opt_rate = strtol(optarg, &endptr, 10);
+	if (*endptr == ':')
+	  opt_burst = strtol(endptr + 1, &endptr, 10);
+	else
+	  opt_burst = 1;
+	if (*endptr || (opt_rate <= 0) || (opt_burst <= 0))
+	  ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		  _("Invalid probes rate: %s"), optarg);
+      }
+      break;
+    case OPT_RCVBUF:		/* size of the receive buffers */
+      {
+	char *endptr;
+	long size, unit = 1;
+
+	size = strtol(optarg, &endptr, 10);
+	if (*endptr && !endptr[1] && strchr("kKmM", *endptr))
+	  unit = (tolower((int)*endptr) == 'm' ? 1048576 : 1024);
+	else if (*endptr || (endptr == optarg))
+	  size = 0;
+	/* the size must still fit the int of setsockopt() once scaled */
+	if ((size <= 0) || (size > INT_MAX / unit))
+	  sockopts.rcvbuf = 0;
+	else
+	  sockopts.rcvbuf = size * unit;
+	if (sockopts.rcvbuf <= 0)
+	  ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		  _("Invalid receive buffer size: %s"), optarg);
+      }
+      break;
+    case OPT_RESET:		/* close scan probes with a RST */
+      opt_reset = TRUE;
+      break;
+    case OPT_RETRIES:		/* retransmissions of unanswered UDP probes */
+      opt_retries = atoi(optarg);
+      if ((opt_retries < 0) || !isdigit((int)optarg[0]))
 	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
-		_("Couldn't resolve local host: %s"), optarg);
+		_("Invalid number of retries: %s"), optarg);
+      break;
+    case OPT_SESSIONS:		/* serve many UDP peers at once */
+      opt_sessions = (optarg ? atoi(optarg) : NETCAT_SESSION_IDLE);
+      if (opt_sessions <= 0)
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Invalid sessions idle time: %s"), optarg);
+      break;
+    case 's':			/* local source address */
+      /* lookup the source address and assign it to the connection address.
+         Further source addresses are appended to the first one, and the
+         scanning engine rotates through all of them. */
+      {
+	nc_host_t tmp_host;
+	int i, j;
+
+	if (!netcat_resolvehost(&tmp_host, optarg))
+	  ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		  _("Couldn't resolve local host: %s"), optarg);
+	if (!local_host.host.iaddrs[0].s_addr) {
+	  memcpy(&local_host, &tmp_host, sizeof(local_host));
+	  break;
+	}
+
+	for (i = 0; (i < MAXINETADDRS) && local_host.host.iaddrs[i].s_addr; i++);
+	for (j = 0; (j < MAXINETADDRS) && tmp_host.host.iaddrs[j].s_addr; j++, i++) {
+	  if (i == MAXINETADDRS)
+	    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		    _("Too many source addresses (max %d)"), MAXINETADDRS);
+	  memcpy(&local_host.host.iaddrs[i], &tmp_host.host.iaddrs[j],
+		 sizeof(local_host.host.iaddrs[i]));
+	  memcpy(local_host.host.addrs[i], tmp_host.host.addrs[j],
+		 sizeof(local_host.host.addrs[i]));
+	}
+      }
       break;
     case 'S':			/* used only in tunnel mode (source ip) */
       if (!netcat_resolvehost(&connect_sock.local, optarg))
 	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
 		_("Couldn't resolve tunnel local host: %s"), optarg);
       break;
+    case OPT_SINCE:		/* incremental scan */
+      {
+	char *endptr;
+
+	opt_since = strtol(optarg, &endptr, 10);
+	if (*endptr && !endptr[1] && strchr("smhd", *endptr))
+	  opt_since *= (*endptr == 'm' ? 60 : *endptr == 'h' ? 3600 :
+			*endptr == 'd' ? 86400 : 1);
+	else if (*endptr || (endptr == optarg))
+	  opt_since = -1;
+	if (opt_since < 0)
+	  ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		  _("Invalid incremental scan age: %s"), optarg);
+      }
+      break;
+    case OPT_STATEFILE:		/* persistent scan results */
+      opt_statefile = strdup(optarg);
+      break;
+    case OPT_SYN:		/* half-open scan */
+      opt_syn = TRUE;
+      opt_zero = TRUE;		/* implied */
+      break;
+    case OPT_TARGETLIST:	/* bulk checks from a targets list */
+      opt_targetlist = strdup(optarg);
+      opt_zero = TRUE;		/* implied */
+      break;
     case 1:			/* use TCP protocol (default) */
 #ifndef USE_OLD_COMPAT
     case 't':
@@ -383,6 +652,12 @@ int main(int argc, char *argv[])
 	ncprint(NCPRINT_ERROR | NCPRINT_EXIT, _("Invalid wait-time: %s"),
 		optarg);
       break;
+    case OPT_WORKERS:		/* processes sharing the UDP listen port */
+      opt_workers = atoi(optarg);
+      if ((opt_workers <= 0) || (opt_workers > NETCAT_WORKERS_MAX))
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Invalid number of workers: %s"), optarg);
+      break;
     case 'x':			/* hexdump traffic */
       opt_hexdump = TRUE;
       break;
@@ -435,10 +710,97 @@ int main(int argc, char *argv[])
   debug_v(("Trying to parse non-args parameters (argc=%d, optind=%d)", argc,
 	  optind));
 
-  /* try to get an hostname parameter */
+  if ((opt_since >= 0) && !opt_statefile)
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("Incremental scans (`--since') require a state file"));
+
+  if (opt_syn && ((opt_proto == NETCAT_PROTO_UDP) || opt_banner ||
+		  (opt_domain != NETCAT_DOMAIN_IPV4)))
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("SYN scans (`--syn') support only TCP over IPv4, without banners"));
+
+  if (opt_sessions && ((netcat_mode != NETCAT_LISTEN) ||
+		       (opt_proto != NETCAT_PROTO_UDP) || opt_zero))
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("UDP sessions (`--sessions') require the UDP listen mode, without `-z'"));
+
+  if ((sockopts.joins || sockopts.mcast_ttl || sockopts.mcast_if.s_addr) &&
+      ((opt_proto != NETCAT_PROTO_UDP) || (opt_domain == NETCAT_DOMAIN_IPV6)))
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("Multicast options require UDP over IPv4"));
+
+  if (sockopts.joins) {
+    if (netcat_mode != NETCAT_LISTEN)
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	      _("Multicast groups (`--join') can only be joined in listen mode"));
+    if (local_host.host.iaddrs[0].s_addr)
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	      _("Multicast groups (`--join') can't be used with `-s'"));
+
+    /* once connected to the peer, the socket only gets the datagrams of the
+       group it is bound to, so the plain listen mode binds to its group */
+    if (!opt_zero && !opt_sessions) {
+      if (sockopts.joins > 1)
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Only one multicast group (`--join') can be joined without `-z' or `--sessions'"));
+      local_host.host.iaddrs[0] = sockopts.join[0].group;
+      strncpy(local_host.host.addrs[0],
+	      netcat_inet_ntop(AF_INET, &sockopts.join[0].group),
+	      sizeof(local_host.host.addrs[0]) - 1);
+    }
+  }
+
+  if (sockopts.pmtu) {
+    if ((opt_proto != NETCAT_PROTO_UDP) || opt_sessions ||
+	(opt_domain == NETCAT_DOMAIN_IPV6))
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	      _("Path MTU sizing (`--pmtu') requires UDP over IPv4, without `--sessions'"));
+#ifndef USE_PMTU
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("Path MTU sizing (`--pmtu') is not supported on this system"));
+#endif
+  }
+
+  if (opt_framing) {
+    if ((opt_proto != NETCAT_PROTO_UDP) || opt_telnet || opt_interval)
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	      _("Framing (`--framing') requires UDP, without `-i' or `--telnet'"));
+#ifndef USE_MMSG
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("Framing (`--framing') is not supported on this system"));
+#endif
+  }
+
+  if (opt_workers > 1) {
+    if ((netcat_mode != NETCAT_LISTEN) || (opt_proto != NETCAT_PROTO_UDP) ||
+	(!opt_zero && !opt_sessions))
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	      _("Workers (`--workers') require the UDP listen mode, with `-z' or `--sessions'"));
+    if (!local_port.num)
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	      _("Workers (`--workers') require a local port"));
+#ifndef SO_REUSEPORT
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("Workers (`--workers') are not supported on this system"));
+#endif
+    sockopts.reuseport = TRUE;
+  }
+
+  if (opt_targetlist && (optind < argc))
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("Cannot specify both a targets list and a hostname"));
+
+  /* try to get an hostname parameter.  Address ranges and lists (and any
+     target at all when concurrent scanning was requested) are stored in the
+     targets set, which is expanded lazily by the scanning engine. */
   if (optind < argc) {
     const char *get_host = argv[optind++];
-    if (!netcat_resolvehost(&remote_host, get_host))
+    if (opt_parallel || netcat_targets_isrange(get_host)) {
+      if (!netcat_targets_parse(&remote_targets, get_host))
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Invalid targets specification \"%s\""), get_host);
+    }
+    else if (!resolve_remote(&remote_host, get_host))
       ncprint(NCPRINT_ERROR | NCPRINT_EXIT, _("Couldn't resolve host \"%s\""),
 	      get_host);
   }
@@ -500,6 +862,10 @@ int main(int argc, char *argv[])
 
   /* Handle listen mode and tunnel mode (whose index number is higher) */
   if (netcat_mode > NETCAT_CONNECT) {
+    if (remote_targets || opt_targetlist)
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	      _("Multiple targets can only be used in connect mode"));
+
     /* in tunnel mode the opt_zero flag is illegal, while on listen mode it
        means that no connections should be accepted.  For UDP it means that
        no remote addresses should be used as default endpoint, which means
@@ -510,6 +876,14 @@ int main(int argc, char *argv[])
       use_stdin = FALSE;
     }
 
+    /* from now on each worker does the same job with a socket of its own,
+       while the parent just waits for them */
+    if ((opt_workers > 1) &&
+	((worker = netcat_workers_start(opt_workers)) < 0)) {
+      glob_ret = EXIT_SUCCESS;
+      goto main_exit;
+    }
+
     /* prepare the socket var and start listening */
     listen_sock.proto = opt_proto;
     listen_sock.timeout = opt_wait;
@@ -518,6 +892,17 @@ int main(int argc, char *argv[])
     memcpy(&listen_sock.remote, &remote_host, sizeof(listen_sock.remote));
     listen_sock.remote_ports = old_flag;
     memcpy(&listen_sock.opts, &sockopts, sizeof(listen_sock.opts));
+
+    /* the UDP server mode serves all the peers with a session each, and it
+       doesn't ever pass to the core loop */
+    if (opt_sessions) {
+      if (core_udp_server(&listen_sock, opt_sessions) < 0)
+	ncprint(NCPRINT_VERB1 | NCPRINT_EXIT, _("Listen mode failed: %s"),
+		strerror(errno));
+      glob_ret = EXIT_SUCCESS;
+      goto main_exit;
+    }
+
     accept_ret = core_listen(&listen_sock);
 
     /* in zero I/O mode the core_tcp_listen() call will always return -1
@@ -572,8 +957,46 @@ int main(int argc, char *argv[])
   /* we need to connect outside, this is the connect mode */
   netcat_mode = NETCAT_CONNECT;
 
+  /* the results of the previous scans drive the incremental scan */
+  if (opt_statefile && !netcat_state_load(opt_statefile))
+    exit(EXIT_FAILURE);
+
+  /* a targets list carries both the hosts and the ports, so it's handled by
+     the scanning engine before checking the other parameters */
+  if (opt_targetlist) {
+    int list_fd = STDIN_FILENO;
+
+    if (strcmp(opt_targetlist, "-")) {
+      list_fd = open(opt_targetlist, O_RDONLY);
+      if (list_fd < 0)
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+		_("Failed to open targets list: %s (%s)"), opt_targetlist,
+		strerror(errno));
+    }
+
+    connect_sock.proto = opt_proto;
+    connect_sock.timeout = opt_wait;
+    memcpy(&connect_sock.local, &local_host, sizeof(connect_sock.local));
+    memcpy(&connect_sock.local_port, &local_port,
+	   sizeof(connect_sock.local_port));
+    memcpy(&connect_sock.opts, &sockopts, sizeof(connect_sock.opts));
+
+    if (core_scan(&connect_sock, NULL, NULL, list_fd,
+		  (opt_parallel ? opt_parallel : NETCAT_SCAN_PARALLEL)) > 0)
+      glob_ret = EXIT_SUCCESS;
+    if (opt_statefile)
+      netcat_state_save(opt_statefile);
+    if (list_fd != STDIN_FILENO)
+      close(list_fd);
+    goto main_exit;
+  }
+
   /* first check that a host parameter was given */
-  if (!remote_host.host.iaddrs[0].s_addr) {
+  if (!remote_targets && !remote_host.host.iaddrs[0].s_addr
+#ifdef USE_IPV6
+      && IN6_IS_ADDR_UNSPECIFIED(&remote_host.host6.iaddrs[0])
+#endif
+      ) {
     /* FIXME: The Networking specifications state that host address "0" is a
        valid host to connect to but this broken check will assume as not
        specified. */
@@ -587,6 +1010,56 @@ int main(int argc, char *argv[])
     ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
 	    _("No ports specified for connection"));
 
+  /* a UDP port can only be told open or closed by waiting for the answers
+     and the ICMP errors, which is done by the UDP scanner even for a single
+     host.  The same goes for banners, which are grabbed concurrently, for
+     the results recorded in the state file or exported, and for the SYN
+     scan. */
+  if (opt_zero && ((opt_proto == NETCAT_PROTO_UDP) || opt_banner ||
+		   opt_statefile || opt_syn ||
+		   (opt_format != NETCAT_FORMAT_TEXT)) && !remote_targets) {
+    if (!remote_host.host.iaddrs[0].s_addr)
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	      _("The scanning engine supports only IPv4 targets"));
+    netcat_targets_insert(&remote_targets, &remote_host);
+  }
+
+  /* multiple hosts are handled by the concurrent scanning engine, which
+     shares one pool of probes between all the hosts and ports */
+  if (remote_targets) {
+    if (!opt_zero)
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	      _("Scanning multiple targets requires the zero-I/O mode (`-z')"));
+
+    connect_sock.proto = opt_proto;
+    connect_sock.timeout = opt_wait;
+    memcpy(&connect_sock.local, &local_host, sizeof(connect_sock.local));
+    memcpy(&connect_sock.local_port, &local_port,
+	   sizeof(connect_sock.local_port));
+    memcpy(&connect_sock.opts, &sockopts, sizeof(connect_sock.opts));
+
+    if (core_scan(&connect_sock, remote_targets, old_flag, -1,
+		  (opt_parallel ? opt_parallel : NETCAT_SCAN_PARALLEL)) > 0)
+      glob_ret = EXIT_SUCCESS;
+    if (opt_statefile)
+      netcat_state_save(opt_statefile);
+    netcat_targets_free(remote_targets);
+    goto main_exit;
+  }
+
+  /* since we are nonblocking now, we can start as many connections as we want
+     but it's not a great idea connecting more than one host at time.  The
+     connection record is the same for all the ports, only the port changes
+     (core_connect() may move the address it used to the front, which is
+     just as good for the next port) */
+  connect_sock.proto = opt_proto;
+  connect_sock.timeout = opt_wait;
+  memcpy(&connect_sock.local, &local_host, sizeof(connect_sock.local));
+  memcpy(&connect_sock.local_port, &local_port,
+	 sizeof(connect_sock.local_port));
+  memcpy(&connect_sock.remote, &remote_host, sizeof(connect_sock.remote));
+  memcpy(&connect_sock.opts, &sockopts, sizeof(connect_sock.opts));
+
   c = 0;			/* must be set to 0 for netcat_ports_next() */
   left_ports = total_ports;
   while (left_ports > 0) {
@@ -599,18 +1072,8 @@ int main(int argc, char *argv[])
       c = netcat_ports_next(old_flag, c);
     left_ports--;		/* decrease the total ports number to try */
 
-    /* since we are nonblocking now, we can start as many connections as we want
-       but it's not a great idea connecting more than one host at time */
-    connect_sock.proto = opt_proto;
-    connect_sock.timeout = opt_wait;
-    memcpy(&connect_sock.local, &local_host, sizeof(connect_sock.local));
-    memcpy(&connect_sock.local_port, &local_port,
-	   sizeof(connect_sock.local_port));
-    memcpy(&connect_sock.remote, &remote_host, sizeof(connect_sock.remote));
-    memcpy(&connect_sock.opts, &sockopts, sizeof(connect_sock.opts));
     netcat_getport(&connect_sock.port, NULL, c);
 
-    /* FIXME: in udp mode and NETCAT_CONNECT, opt_zero is senseless */
     connect_ret = core_connect(&connect_sock);
 
     /* connection failure? (we cannot get this in UDP mode) */
@@ -634,8 +1097,12 @@ int main(int argc, char *argv[])
     glob_ret = EXIT_SUCCESS;
 
     if (opt_zero) {
-      shutdown(connect_ret, 2);
-      close(connect_ret);
+      if (opt_reset)
+	netcat_close_reset(connect_ret);
+      else {
+	shutdown(connect_ret, 2);
+	close(connect_ret);
+      }
     }
     else {
       if (opt_exec) {
@@ -659,6 +1126,8 @@ int main(int argc, char *argv[])
  main_exit:
   debug_v(("Main: EXIT (cleaning up)"));
 
-  netcat_printstats(FALSE);
+  /* the parent prints the totals of all the workers */
+  if (worker < 0)
+    netcat_printstats(FALSE);
   return glob_ret;
 }				/* end of main() */
@@ -38,7 +38,9 @@
 #include <sys/socket.h>
 #include <sys/uio.h>		/* needed for reading/writing vectors */
 #include <sys/param.h>		/* defines MAXHOSTNAMELEN and other stuff */
+#include <limits.h>		/* IOV_MAX */
 #include <netinet/in.h>
+#include <netinet/udp.h>	/* UDP_SEGMENT, UDP_GRO */
 #include <arpa/inet.h>		/* inet_ntop(), inet_pton() */
 
 /* These are useful to keep the source readable */
@@ -88,6 +90,63 @@
 # endif
 #endif
 
+/* The BSDs tell the destination address of the incoming datagrams with the
+   IP_RECVDSTADDR option instead.  Either way a single socket bound to any
+   address is enough for the UDP listen mode, which otherwise needs a socket
+   for each local address. */
+#ifdef USE_PKTINFO
+# define USE_DSTADDR
+# define NETCAT_DSTADDR_SPACE CMSG_SPACE(sizeof(struct in_pktinfo))
+#elif defined(IP_RECVDSTADDR)
+# define USE_DSTADDR
+# define USE_RECVDSTADDR
+# define NETCAT_DSTADDR_SPACE CMSG_SPACE(sizeof(struct in_addr))
+#endif
+
+/* The same ancillary data (IP_SENDSRCADDR on the BSDs) chooses the source
+   address of a datagram sent from a socket bound to any address. */
+#if defined(USE_PKTINFO) || \
+    (defined(USE_RECVDSTADDR) && defined(IP_SENDSRCADDR))
+# define USE_SENDSRC
+#endif
+
+/* Find out whether the ICMP errors caused by the datagrams sent from an
+   unconnected UDP socket can be fetched from the socket error queue. */
+#ifdef HAVE_LINUX_ERRQUEUE_H
+# if defined(SOL_IP) && defined(IP_RECVERR) && defined(MSG_ERRQUEUE)
+#  define USE_RECVERR
+# endif
+#endif
+
+/* Find out whether the kernel tells how many datagrams it dropped because
+   the receive queue of the socket was full */
+#ifdef SO_RXQ_OVFL
+# define USE_RXQ_OVFL
+#endif
+
+/* Find out whether the path MTU discovery can be enforced on the UDP sockets,
+   and the MTU found read back */
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_DO) && defined(IP_MTU)
+# define USE_PMTU
+#endif
+
+/* Find out whether several datagrams can be moved by each system call */
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+# define USE_MMSG
+#endif
+
+/* Find out whether the kernel can split the UDP datagrams on the way out
+   (segmentation offload) and merge them on the way in (receive offload) */
+#if defined(USE_MMSG) && defined(SOL_UDP) && defined(UDP_SEGMENT) && \
+    defined(UDP_GRO)
+# define USE_UDP_OFFLOAD
+#endif
+
+/* Not all the systems define the maximum length of an I/O vector */
+#ifndef IOV_MAX
+# define IOV_MAX 16
+#endif
+
 /* MAXINETADDR defines the maximum number of host aliases that are saved after
    a successfully hostname lookup.  This will have impact on following lookups,
    in case `-v' switch was specified, and on memory usage. Each struct takes
@@ -95,6 +154,60 @@
    MAXINETADDRS * (NETCAT_ADDRSTRLEN + sizeof(struct in_addr)) */
 #define MAXINETADDRS 6
 
+/* Default number of probes kept in flight at the same time by the scanning
+   engine when scanning multiple targets. */
+#define NETCAT_SCAN_PARALLEL 64
+
+/* Number of times an unanswered UDP probe is sent again, and the default time
+   (in seconds) to wait for an answer to each of them. */
+#define NETCAT_UDP_RETRIES 2
+#define NETCAT_UDP_TIMEOUT 1
+
+/* Maximum number of datagrams moved by each recvmmsg(2) or sendmmsg(2) call
+   in UDP mode. */
+#define NETCAT_UDP_BATCH 32
+
+/* Size of the buffers receiving the UDP datagrams, which always fits the
+   largest datagram. */
+#define NETCAT_DGRAM_MAX 65536
+
+/* Default time (in seconds) after which a quiet peer of the UDP server mode
+   loses its session. */
+#define NETCAT_SESSION_IDLE 60
+
+/* Maximum number of worker processes sharing the UDP listen port */
+#define NETCAT_WORKERS_MAX 256
+
+/* Maximum number of multicast groups joined, which is also the default limit
+   of each socket on Linux */
+#define NETCAT_MCAST_MAX 20
+
+/* Default maximum size of a grabbed banner, and default time (in seconds) to
+   wait for it once connected. */
+#define NETCAT_BANNER_SIZE 256
+#define NETCAT_BANNER_WAIT 2
+
+/* Delay (in milliseconds) between the connection attempts to the addresses
+   of a host, as recommended by RFC 8305 ("Happy Eyeballs"). */
+#define NETCAT_CONNECT_DELAY 250
+
+/* Number of times an unanswered query of the built-in DNS resolver is sent
+   again, and the time (in seconds) to wait for the answer to each of them.
+   Its answers are cached for at most NETCAT_DNS_MAX_TTL seconds, whatever
+   the TTL of the records. */
+#define NETCAT_DNS_RETRIES 2
+#define NETCAT_DNS_TIMEOUT 2
+#define NETCAT_DNS_MAX_TTL 3600
+
+/* Number of slots of a new lookups cache file, and number of consecutive
+   slots where each key is searched.  The answers of the system resolver are
+   cached for NETCAT_CACHE_TTL seconds (the built-in resolver uses the TTL of
+   the records), the services database for NETCAT_CACHE_SERV_TTL seconds. */
+#define NETCAT_CACHE_SLOTS 4096
+#define NETCAT_CACHE_PROBES 8
+#define NETCAT_CACHE_TTL 300
+#define NETCAT_CACHE_SERV_TTL 86400
+
 #ifndef INADDR_NONE
 # define INADDR_NONE 0xffffffff
 #endif
@@ -272,11 +385,128 @@ typedef struct {
 
 typedef struct nc_ports_st *nc_ports_t;
 
+/**
+ * Declare a private object that represents a set of target hosts
+ *
+ * The definition and handling of this object is delegated to the targets
+ * manager module.  Address ranges are stored unexpanded and are walked
+ * through a nc_targets_pos_t iterator.
+ */
+
+typedef struct nc_targets_st *nc_targets_t;
+
+/**
+ * Iterator over a targets set.
+ */
+
+typedef struct {
+  nc_targets_t node;	/**< Range the iterator is currently in. */
+  unsigned long offset;	/**< Offset of the next address in the range. */
+} nc_targets_pos_t;
+
+/**
+ * Scan results
+ *
+ * The state of a scanned port, as stored in the state file.  The numeric
+ * values are part of the file format, so new states must be appended.
+ */
+
+typedef enum {
+  NETCAT_STATE_UNKNOWN,		/**< Never scanned. */
+  NETCAT_STATE_OPEN,		/**< Connected, or answered. */
+  NETCAT_STATE_CLOSED,		/**< Connection refused. */
+  NETCAT_STATE_TIMEOUT,		/**< No answer within the timeout. */
+  NETCAT_STATE_UNREACHABLE,	/**< Host or network unreachable. */
+  NETCAT_STATE_FILTERED,	/**< Administratively prohibited. */
+  NETCAT_STATE_OPENFILTERED,	/**< UDP port that never answered. */
+  NETCAT_STATE_ERROR		/**< Any other error. */
+} nc_scanstate_t;
+
+/**
+ * Format of the scan result lines printed on the standard output.
+ */
+
+typedef enum {
+  NETCAT_FORMAT_TEXT,		/**< "host:port state" lines. */
+  NETCAT_FORMAT_CSV,		/**< Comma separated values, with a header. */
+  NETCAT_FORMAT_JSON		/**< One JSON object per line. */
+} nc_format_t;
+
+/**
+ * Framing of the UDP datagrams on the stream side (stdin and stdout, or the
+ * stream socket of a tunnel), which tells where each datagram begins and
+ * ends.
+ */
+
+typedef enum {
+  NETCAT_FRAMING_NONE,		/**< Raw data, in chunks of any size. */
+  NETCAT_FRAMING_LINE,		/**< One datagram per line. */
+  NETCAT_FRAMING_LEN		/**< Each datagram after its length, as a 16 bits
+				 *   number in network byte order. */
+} nc_framing_t;
+
+/**
+ * Splits the stream read from a descriptor in framed records.  The records
+ * returned point into \a buf, so they are valid until the next fill.
+ */
+
+typedef struct {
+  unsigned char *buf;		/**< Data read and not yet returned. */
+  size_t pos;			/**< Start of the next record in \a buf. */
+  size_t len;			/**< End of the data in \a buf. */
+  bool eof;			/**< The descriptor reached EOF. */
+} nc_framer_t;
+
+/**
+ * Types of the entries of the lookups cache.  The keys are hostnames, dotted
+ * addresses, or "proto/service" strings for the services database.
+ */
+
+typedef enum {
+  NETCAT_CACHE_HOST = 1,	/**< Name to addresses (struct in_addr). */
+  NETCAT_CACHE_PTR,		/**< Address to name, verified by a direct
+				 *   lookup. */
+  NETCAT_CACHE_SERVNAME,	/**< Service name to port (network byte order)
+				 *   and official name. */
+  NETCAT_CACHE_SERVPORT,	/**< Port number to service name. */
+  NETCAT_CACHE_DNSPTR		/**< Address to name, as answered to the
+				 *   built-in resolver (not verified). */
+} nc_cache_t;
+
+/**
+ * Callback of the built-in DNS resolver.  On success \a naddrs addresses are
+ * passed in \a addrs, and \a name is the queried name (or the answer of a
+ * reverse lookup, in which case \a addrs holds the queried address).  On
+ * failure \a naddrs is 0 and \a name is NULL.
+ */
+
+typedef void (*nc_dns_cb_t)(void *arg, const struct in_addr *addrs,
+			    int naddrs, const char *name);
+
+/**
+ * A multicast group joined by the UDP sockets, either for the datagrams of
+ * any source or of a single one (source-specific multicast).
+ */
+typedef struct {
+  struct in_addr group;		/**< Address of the group. */
+  struct in_addr source;	/**< Only source, INADDR_ANY for any. */
+} nc_mcast_t;
+
 /**
  * Socket options.
  */
 typedef struct {
   bool keepalive;	/**< Enable TCP keepalive. */
+  bool reuseport;	/**< Share the local port with other sockets. */
+  int rcvbuf;		/**< Size of the receive buffer, 0 for the system
+			 *   default. */
+  bool pmtu;		/**< Never fragment the UDP datagrams. */
+  int mcast_ttl;	/**< TTL of the multicast datagrams sent, 0 for the
+			 *   system default. */
+  struct in_addr mcast_if; /**< Local address of the interface used for
+			 *   multicast, INADDR_ANY for the default. */
+  int joins;		/**< Number of groups in \a join. */
+  nc_mcast_t join[NETCAT_MCAST_MAX]; /**< Multicast groups to join. */
 } nc_sockopts_t;
 
 /**
@@ -32,6 +32,13 @@
 
 unsigned long bytes_sent = 0;		/* total bytes received */
 unsigned long bytes_recv = 0;		/* total bytes sent */
+unsigned long dgrams_recv = 0;		/* datagrams delivered */
+unsigned long dgrams_dropped = 0;	/* datagrams lost on our side */
+unsigned long dgrams_toobig = 0;	/* datagrams refused for the path MTU */
+
+/* Size of the chunks read from stdin.  In UDP mode each chunk is sent as a
+   datagram of its own, so with `--pmtu' they are sized to the path MTU. */
+#define CORE_DGRAM_SIZE 1024
 
 /* Creates a UDP socket with a default destination address.  It also calls
    bind(2) if it is needed in order to specify the source address.
@@ -64,6 +71,29 @@ static int core_udp_connect(nc_sock_t *ncsock)
   return -1;
 }				/* end of core_udp_connect() */
 
+#ifdef USE_DSTADDR
+/* Finds out the source address the routing table chooses for the datagrams
+   sent to `addr', by connecting a scratch socket to it.
+   Returns 0 on success, or -1 on error. */
+
+static int core_route_src(const struct sockaddr_in *addr, struct in_addr *src)
+{
+  struct sockaddr_in my_addr;
+  unsigned int my_addr_len = sizeof(my_addr);
+  int sock, ret;
+
+  if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) < 0)
+    return -1;
+  ret = connect(sock, (const struct sockaddr *)addr, sizeof(*addr));
+  if (ret == 0)
+    ret = getsockname(sock, (struct sockaddr *)&my_addr, &my_addr_len);
+  close(sock);
+  if (ret == 0)
+    *src = my_addr.sin_addr;
+  return ret;
+}
+#endif
+
 /* Emulates a TCP connection but using the UDP protocol.  There is a listening
    socket that catches the first valid packet and assumes the packet endpoints
    as the endpoints for the final connection. */
@@ -72,17 +102,18 @@ static int core_udp_listen(nc_sock_t *ncsock)
 {
   int ret, *sockbuf, sock, sock_max, timeout = ncsock->timeout;
   bool need_udphelper = TRUE;
-#ifdef USE_PKTINFO
-  int sockopt = 1;
+#if defined(USE_DSTADDR) && defined(USE_RXQ_OVFL)
+  unsigned int drops = 0;	/* datagrams dropped by the kernel so far */
 #endif
   struct timeval tt;		/* needed by the select() call */
   debug_v(("core_udp_listen(ncsock=%p)", (void *)ncsock));
 
-#ifdef USE_PKTINFO
+#ifdef USE_DSTADDR
   need_udphelper = FALSE;
 #else
-  /* if we need a specified source address then go straight to it */
-  if (ncsock->local.host.iaddrs[0].s_addr)
+  /* if we need a specified source address then go straight to it.  The
+     multicast datagrams only reach a socket bound to any address, too. */
+  if (ncsock->local.host.iaddrs[0].s_addr || ncsock->opts.joins)
     need_udphelper = FALSE;
 #endif
 
@@ -92,7 +123,7 @@ static int core_udp_listen(nc_sock_t *ncsock)
     sockbuf[0] = 1;
     sockbuf[1] = sock = netcat_socket_new(ncsock->domain, NETCAT_PROTO_UDP, &ncsock->opts);
   }
-#ifndef USE_PKTINFO
+#ifndef USE_DSTADDR
   else
     sock = udphelper_sockets_open(&sockbuf, ncsock->local_port.netnum);
 #endif
@@ -111,9 +142,9 @@ static int core_udp_listen(nc_sock_t *ncsock)
       goto err;
   }
 
-#ifdef USE_PKTINFO
+#ifdef USE_DSTADDR
   /* set the right flag in order to obtain the ancillary data */
-  ret = setsockopt(sock, SOL_IP, IP_PKTINFO, &sockopt, sizeof(sockopt));
+  ret = udphelper_dstaddr(sock, TRUE);
   if (ret < 0)
     goto err;
 #endif
@@ -166,11 +197,11 @@ static int core_udp_listen(nc_sock_t *ncsock)
     for (socks_loop = 1; socks_loop <= sockbuf[0]; socks_loop++) {
       int recv_ret, write_ret;
       struct msghdr my_hdr;
-      unsigned char buf[1024];
+      unsigned char buf[NETCAT_DGRAM_MAX];
       struct iovec my_hdr_vec;
       struct sockaddr_in rem_addr;
       struct sockaddr_in local_addr;
-#ifdef USE_PKTINFO
+#ifdef USE_DSTADDR
       unsigned char anc_buf[512];
 #endif
 
@@ -192,8 +223,9 @@ static int core_udp_listen(nc_sock_t *ncsock)
       my_hdr_vec.iov_len = sizeof(buf);
       my_hdr.msg_iov = &my_hdr_vec;
       my_hdr.msg_iovlen = 1;
-#ifdef USE_PKTINFO
-      /* now the core part for the IP_PKTINFO support: the ancillary data */
+#ifdef USE_DSTADDR
+      /* now the core part for the IP_PKTINFO (or IP_RECVDSTADDR) support:
+         the ancillary data */
       my_hdr.msg_control = anc_buf;
       my_hdr.msg_controllen = sizeof(anc_buf);
 #endif
@@ -201,11 +233,16 @@ static int core_udp_listen(nc_sock_t *ncsock)
       /* now check the remote address.  If we are simulating a routing then
          use the MSG_PEEK flag, which leaves the received packet untouched */
       recv_ret = recvmsg(sock, &my_hdr, (opt_zero ? 0 : MSG_PEEK));
+      if (recv_ret < 0) {
+	if (errno == EINTR)
+	  continue;
+	goto err;
+      }
 
       debug_v(("received packet from %s:%d%s", netcat_inet_ntop(AF_INET, &rem_addr.sin_addr),
 		ntohs(rem_addr.sin_port), (opt_zero ? "" : ", using as default dest")));
 
-#ifdef USE_PKTINFO
+#ifdef USE_DSTADDR
       ret = udphelper_ancillary_read(&my_hdr, &local_addr);
       local_addr.sin_port = ncsock->local_port.netnum;
       local_addr.sin_family = AF_INET;
@@ -228,7 +265,16 @@ static int core_udp_listen(nc_sock_t *ncsock)
 		netcat_inet_ntop(AF_INET, &rem_addr.sin_addr), ntohs(rem_addr.sin_port));
 
       if (opt_zero) {		/* output the packet right here right now */
-	write_ret = write(STDOUT_FILENO, buf, recv_ret);
+#if defined(USE_DSTADDR) && defined(USE_RXQ_OVFL)
+	udphelper_ancillary_drops(&my_hdr, &drops);
+#endif
+	dgrams_recv++;
+	if (my_hdr.msg_flags & MSG_TRUNC)
+	  ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+		  _("Datagram from %s:%d truncated to %d bytes"),
+		  netcat_inet_ntop(AF_INET, &rem_addr.sin_addr),
+		  ntohs(rem_addr.sin_port), recv_ret);
+	write_ret = netcat_framing_write(STDOUT_FILENO, buf, recv_ret);
 	bytes_recv += write_ret;
 	debug_dv(("write_u(stdout) = %d", write_ret));
 
@@ -250,42 +296,64 @@ static int core_udp_listen(nc_sock_t *ncsock)
 	}
       }
       else {
-#ifdef USE_PKTINFO
-	nc_sock_t dup_socket;
-
-	memset(&dup_socket, 0, sizeof(dup_socket));
-	dup_socket.domain = ncsock->domain;
-	dup_socket.proto = ncsock->proto;
-	memcpy(&dup_socket.local.host.iaddrs[0], &local_addr.sin_addr,
-	       sizeof(local_addr));
-	memcpy(&dup_socket.remote.host.iaddrs[0], &rem_addr.sin_addr,
-	       sizeof(local_addr));
-	dup_socket.local_port.netnum = local_addr.sin_port;
-	dup_socket.local_port.num = ntohs(local_addr.sin_port);
-	dup_socket.port.netnum = rem_addr.sin_port;
-	dup_socket.port.num = ntohs(rem_addr.sin_port);
-	/* copy the received data in the socket's queue */
-	ncsock->recvq.len = recv_ret;
-	ncsock->recvq.head = ncsock->recvq.pos = malloc(recv_ret);
-	memcpy(ncsock->recvq.head, my_hdr_vec.iov_base, recv_ret);
-	/* FIXME: this ONLY saves the first 1024 bytes! and the others? */
-#else
-	ret = connect(sock, (struct sockaddr *)&rem_addr, sizeof(rem_addr));
-	if (ret < 0)
+	bool connect_peer = TRUE;
+
+#ifdef USE_DSTADDR
+	/* a socket bound to any address gets its source address from the
+	   routing table, which may not be the address the peer wrote to.  The
+	   destination of the next datagrams is known, so stop asking it. */
+	{
+	  struct sockaddr_in my_addr;
+	  unsigned int my_addr_len = sizeof(my_addr);
+	  struct in_addr route_src;
+
+	  udphelper_dstaddr(sock, FALSE);
+
+	  /* connect(2) would also bind such a socket to the address chosen by
+	     the routing table, and the next datagrams of the peer would be
+	     refused.  So the socket is left unconnected, and core_readwrite()
+	     sends each datagram from the right address, but a program started
+	     with `-e' (or the telnet codes) writes to the socket on its own. */
+	  if (local_addr.sin_addr.s_addr &&
+	      !getsockname(sock, (struct sockaddr *)&my_addr, &my_addr_len) &&
+	      (my_addr.sin_addr.s_addr == INADDR_ANY) &&
+	      !core_route_src(&rem_addr, &route_src) &&
+	      (route_src.s_addr != local_addr.sin_addr.s_addr)) {
+#ifdef USE_SENDSRC
+	    if (!opt_exec && !opt_telnet) {
+	      ncsock->local.host.iaddrs[0] = local_addr.sin_addr;
+	      strncpy(ncsock->local.host.addrs[0],
+		      netcat_inet_ntop(AF_INET, &local_addr.sin_addr),
+		      sizeof(ncsock->local.host.addrs[0]) - 1);
+	      ncsock->remote.host.iaddrs[0] = rem_addr.sin_addr;
+	      strncpy(ncsock->remote.host.addrs[0],
+		      netcat_inet_ntop(AF_INET, &rem_addr.sin_addr),
+		      sizeof(ncsock->remote.host.addrs[0]) - 1);
+	      connect_peer = FALSE;
+	    }
+	    else
+#endif
+	    ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+		    _("Replies will be sent from %s"),
+		    netcat_inet_ntop(AF_INET, &route_src));
+	  }
+	}
+#endif
+
+	/* the same socket is used for the whole session.  Connecting it to
+	   the peer makes the kernel drop the datagrams of anybody else, while
+	   the queued ones (this first one too, since it was just peeked) are
+	   left for core_readwrite(), which reads them at their full size and
+	   skips those of the other peers (see core_dgram_init()). */
+	if (connect_peer &&
+	    (connect(sock, (struct sockaddr *)&rem_addr, sizeof(rem_addr)) < 0))
 	  goto err;
+	netcat_getport(&ncsock->port, NULL, ntohs(rem_addr.sin_port));
 
 	/* remove this socket from the array in order not to get it closed */
 	sockbuf[socks_loop] = -1;
-#endif
 	udphelper_sockets_close(sockbuf);
-
-#ifdef USE_PKTINFO
-	/* this is all we want from this function */
-	debug_dv(("calling the udp_connect() function..."));
-	return core_udp_connect(&dup_socket);
-#else
 	return sock;
-#endif
       }
     }				/* end of foreach (sock, sockbuf) */
   }				/* end of packet receiving loop */
@@ -298,102 +366,260 @@ static int core_udp_listen(nc_sock_t *ncsock)
   return -1;
 }				/* end of core_udp_listen() */
 
+/* A candidate address for core_tcp_connect(): the address family and the
+   index of the address in the matching array of the remote host record */
+
+typedef struct {
+  nc_domain_t domain;
+  int index;
+} core_candidate_t;
+
+/* Collects the addresses of the remote host that can be connected to,
+   alternating the families as RFC 8305 recommends and starting with IPv6.
+   When the family was forced with `-4' or `-6', or the local address only
+   belongs to one family, only that family is used.
+   Returns the number of candidates stored in `cand'. */
+
+static int core_tcp_candidates(const nc_sock_t *ncsock, core_candidate_t *cand)
+{
+  int i, n = 0;
+  bool use4 = (opt_anyfamily || (opt_domain == NETCAT_DOMAIN_IPV4));
+  bool use6 = FALSE;
+
+#ifdef USE_IPV6
+  use6 = (opt_anyfamily || (opt_domain == NETCAT_DOMAIN_IPV6));
+  if (ncsock->local.host.iaddrs[0].s_addr &&
+      IN6_IS_ADDR_UNSPECIFIED(&ncsock->local.host6.iaddrs[0]))
+    use6 = FALSE;
+  else if (!ncsock->local.host.iaddrs[0].s_addr &&
+	   !IN6_IS_ADDR_UNSPECIFIED(&ncsock->local.host6.iaddrs[0]))
+    use4 = FALSE;
+#endif
+
+  for (i = 0; i < MAXINETADDRS; i++) {
+#ifdef USE_IPV6
+    if (use6 && !IN6_IS_ADDR_UNSPECIFIED(&ncsock->remote.host6.iaddrs[i])) {
+      cand[n].domain = NETCAT_DOMAIN_IPV6;
+      cand[n++].index = i;
+    }
+#endif
+    if (use4 && ncsock->remote.host.iaddrs[i].s_addr) {
+      cand[n].domain = NETCAT_DOMAIN_IPV4;
+      cand[n++].index = i;
+    }
+  }
+  return n;
+}
+
+/* Starts a nonblocking connection to the candidate address `cand'.
+   Returns the new socket descriptor, or a negative value on failure (see
+   netcat_socket_new_connect()). */
+
+static int core_tcp_start(const nc_sock_t *ncsock, const core_candidate_t *cand)
+{
+  nc_host_t remote;
+  bool local = (ncsock->local.host.iaddrs[0].s_addr != 0);
+
+  /* the connection functions always use the first address of the record */
+  memcpy(&remote, &ncsock->remote, sizeof(remote));
+  if (cand->domain == NETCAT_DOMAIN_IPV4)
+    memcpy(&remote.host.iaddrs[0], &ncsock->remote.host.iaddrs[cand->index],
+	   sizeof(remote.host.iaddrs[0]));
+#ifdef USE_IPV6
+  else {
+    memcpy(&remote.host6.iaddrs[0], &ncsock->remote.host6.iaddrs[cand->index],
+	   sizeof(remote.host6.iaddrs[0]));
+    local = !IN6_IS_ADDR_UNSPECIFIED(&ncsock->local.host6.iaddrs[0]);
+  }
+#endif
+
+  debug_v(("Starting connection to address %d (domain=%d)", cand->index,
+	  cand->domain));
+  return netcat_socket_new_connect(cand->domain, ncsock->proto,
+	&remote, &ncsock->port, (local ? &ncsock->local : NULL),
+	&ncsock->local_port, &ncsock->opts);
+}
+
+/* Makes the candidate address `cand' the first one of the remote host record
+   and switches the socket object to its family, so that the connection is
+   reported with the address that was actually used. */
+
+static void core_tcp_select(nc_sock_t *ncsock, const core_candidate_t *cand)
+{
+  ncsock->domain = cand->domain;
+  if (cand->domain == NETCAT_DOMAIN_IPV4) {
+    struct in_addr tmp;
+    char tmpstr[NETCAT_ADDRSTRLEN];
+
+    memcpy(&tmp, &ncsock->remote.host.iaddrs[0], sizeof(tmp));
+    memcpy(&ncsock->remote.host.iaddrs[0],
+	   &ncsock->remote.host.iaddrs[cand->index], sizeof(tmp));
+    memcpy(&ncsock->remote.host.iaddrs[cand->index], &tmp, sizeof(tmp));
+    memcpy(tmpstr, ncsock->remote.host.addrs[0], sizeof(tmpstr));
+    memcpy(ncsock->remote.host.addrs[0],
+	   ncsock->remote.host.addrs[cand->index], sizeof(tmpstr));
+    memcpy(ncsock->remote.host.addrs[cand->index], tmpstr, sizeof(tmpstr));
+  }
+#ifdef USE_IPV6
+  else {
+    struct in6_addr tmp;
+    char tmpstr[NETCAT_ADDRSTRLEN];
+
+    memcpy(&tmp, &ncsock->remote.host6.iaddrs[0], sizeof(tmp));
+    memcpy(&ncsock->remote.host6.iaddrs[0],
+	   &ncsock->remote.host6.iaddrs[cand->index], sizeof(tmp));
+    memcpy(&ncsock->remote.host6.iaddrs[cand->index], &tmp, sizeof(tmp));
+    memcpy(tmpstr, ncsock->remote.host6.addrs[0], sizeof(tmpstr));
+    memcpy(ncsock->remote.host6.addrs[0],
+	   ncsock->remote.host6.addrs[cand->index], sizeof(tmpstr));
+    memcpy(ncsock->remote.host6.addrs[cand->index], tmpstr, sizeof(tmpstr));
+  }
+#endif
+}
+
 /* Creates an outgoing tcp connection to the remote host.  If a local address
    or port is also specified in the socket object, it calls bind(2).
+   When the host has more than one address, the connections are raced as
+   described by RFC 8305 ("Happy Eyeballs"): a new connection attempt is
+   started every NETCAT_CONNECT_DELAY milliseconds (or as soon as an attempt
+   fails), the first one that succeeds is kept and all the others are closed.
+   The timeout applies to the whole race.
    Returns the new socket descriptor or -1 on error. */
 
 static int core_tcp_connect(nc_sock_t *ncsock)
 {
-  int ret, sock, timeout = ncsock->timeout;
-  struct timeval timest;
-  fd_set outs;
+  int i, ret, ncand, started = 0, active = 0, last_err = ETIMEDOUT;
+  int socks[2 * MAXINETADDRS];
+  core_candidate_t cand[2 * MAXINETADDRS];
+  unsigned long long now, deadline = 0, next_start;
   debug_v(("core_tcp_connect(ncsock=%p)", (void *)ncsock));
 
-  /* since we are nonblocking now, we could start as many connections as we
-     want but it's not a great idea connecting more than one host at time.
-     Also don't specify the local address if it's not really needed, so we can
-     avoid one bind(2) call. */
-  sock = netcat_socket_new_connect(ncsock->domain, ncsock->proto,
-	&ncsock->remote, &ncsock->port,
-	(ncsock->local.host.iaddrs[0].s_addr ? &ncsock->local : NULL),
-	&ncsock->local_port,
-	&ncsock->opts);
+  ncand = core_tcp_candidates(ncsock, cand);
+  if (ncand == 0) {
+    errno = EAFNOSUPPORT;
+    return -1;
+  }
 
-  if (sock < 0)
-    ncprint(NCPRINT_ERROR | NCPRINT_EXIT, "Couldn't create connection (err=%d): %s",
-	    sock, strerror(errno));
+  now = netcat_time_usec();
+  next_start = now;
+  if (ncsock->timeout > 0)
+    deadline = now + ncsock->timeout * 1000000ULL;
 
-  /* initialize select()'s variables */
-  FD_ZERO(&outs);
-  FD_SET(sock, &outs);
-  timest.tv_sec = timeout;
-  timest.tv_usec = 0;
+  while (TRUE) {
+    int fd_max = 0;
+    unsigned long long wake = deadline;
+    struct timeval timest;
+    fd_set outs;
+
+    /* start the next connection attempt when its turn has come */
+    now = netcat_time_usec();
+    if ((started < ncand) && (now >= next_start)) {
+      socks[started] = core_tcp_start(ncsock, &cand[started]);
+
+      /* a failure only excludes this address, even when the socket can't be
+         created at all (e.g. a family not supported by this host) */
+      if (socks[started] < 0) {
+	debug_v(("Couldn't start connection to address %d (err=%d): %s",
+		cand[started].index, socks[started], strerror(errno)));
+	last_err = errno;
+	socks[started] = -1;
+      }
+      else {
+	active++;
+	next_start = now + NETCAT_CONNECT_DELAY * 1000ULL;
+      }
+      started++;
+      continue;
+    }
 
-  do {
-    ret = select(sock + 1, NULL, &outs, NULL, (timeout > 0 ? &timest : NULL));
-  } while ((ret == -1) && (errno = EINTR));
+    if (!active && (started == ncand))
+      break;			/* all the attempts failed */
+    if (deadline && (now >= deadline)) {
+      last_err = ETIMEDOUT;
+      break;
+    }
 
-  if (ret < 0)
-    ncprint(NCPRINT_ERROR | NCPRINT_EXIT, "Critical system request failed: %s",
-	    strerror(errno));
-  else {
-    int ret, getret;
-    unsigned int getret_len = sizeof(getret);
+    FD_ZERO(&outs);
+    for (i = 0; i < started; i++)
+      if (socks[i] >= 0) {
+	FD_SET(socks[i], &outs);
+	if (socks[i] >= fd_max)
+	  fd_max = socks[i] + 1;
+      }
+    if ((started < ncand) && (!wake || (next_start < wake)))
+      wake = next_start;
+    if (wake) {
+      unsigned long long wait = (wake > now ? wake - now : 0);
 
-    /* ok, select([single]), so sock must have triggered this */
-    assert(FD_ISSET(sock, &outs));
+      timest.tv_sec = wait / 1000000;
+      timest.tv_usec = wait % 1000000;
+    }
 
-    /* fetch eventual errors of the socket */
-    ret = getsockopt(sock, SOL_SOCKET, SO_ERROR, &getret, &getret_len);
-    if (ret < 0)
+    ret = select(fd_max, NULL, &outs, NULL, (wake ? &timest : NULL));
+    if (ret < 0) {
+      if (errno == EINTR)
+	continue;
       ncprint(NCPRINT_ERROR | NCPRINT_EXIT, "Critical system request failed: %s",
 	      strerror(errno));
+    }
 
-    /* POSIX says that SO_ERROR expects an int, so my_len must be untouched */
-    //assert(getret_len == sizeof(getret_ret));
+    for (i = 0; (ret > 0) && (i < started); i++) {
+      int j, sock, getret;
+      unsigned int getret_len = sizeof(getret);
 
-    /* FIXME: the error Broken Pipe should probably not stop here */
-    debug_v(("Connection returned errcode=%d (%s)", getret, strerror(getret)));
-    if (getret > 0) {
-      char tmp;
+      if ((socks[i] < 0) || !FD_ISSET(socks[i], &outs))
+	continue;
 
-      /* ok, select() returned a write event for this socket AND getsockopt()
-         said that some error happened.  This means that EOF is expected. */
-      ret = read(sock, &tmp, 1);
-      assert(ret == 0);
-      /* FIXME: see the TODO entry about false error detection */
+      /* fetch eventual errors of the socket */
+      if (getsockopt(socks[i], SOL_SOCKET, SO_ERROR, &getret, &getret_len) < 0)
+	ncprint(NCPRINT_ERROR | NCPRINT_EXIT, "Critical system request failed: %s",
+		strerror(errno));
 
-      shutdown(sock, 2);
-      close(sock);
-      errno = getret;		/* value returned by getsockopt(SO_ERROR) */
-      return -1;
-    }
+      debug_v(("Connection returned errcode=%d (%s)", getret, strerror(getret)));
+      if (getret > 0) {
+	/* this address failed, don't wait to try the next one */
+	close(socks[i]);
+	socks[i] = -1;
+	active--;
+	last_err = getret;
+	next_start = now;
+	continue;
+      }
 
-    /* everything went fine, we have the socket */
-    ncprint(NCPRINT_VERB1, _("%s open"),
-	    netcat_strid(ncsock->domain, &ncsock->remote, &ncsock->port));
-    return sock;
+      /* we have a winner: abort all the other attempts */
+      sock = socks[i];
+      for (j = 0; j < started; j++)
+	if ((j != i) && (socks[j] >= 0))
+	  close(socks[j]);
+
+      core_tcp_select(ncsock, &cand[i]);
+      ncprint(NCPRINT_VERB1, _("%s open"),
+	      netcat_strid(ncsock->domain, &ncsock->remote, &ncsock->port));
+      return sock;
+    }
   }
 
-  /* select returned 0, this means connection timed out for our timing
-     directives (in fact the socket has a longer timeout usually, so we need
-     to abort the connection try, set the proper errno and return */
-  shutdown(sock, 2);
-  close(sock);
-  errno = ETIMEDOUT;
+  /* no connection succeeded within the timeout (in fact the sockets have a
+     longer timeout usually, so we need to abort the connection tries), set
+     the proper errno and return */
+  for (i = 0; i < started; i++)
+    if (socks[i] >= 0)
+      close(socks[i]);
+  ncsock->domain = cand[0].domain;
+  errno = last_err;
   return -1;
 }				/* end of core_tcp_connect() */
 
-/* Close the socket by sending a reset (RST) instead of FIN, so that the peer
-   gets a connection reset error. */
-static void close_reset(int sock)
-{
-  struct linger fix_ling;
+/* Reports the name of the peer of an accepted connection, looked up by the
+   built-in resolver. */
 
-  fix_ling.l_onoff = 1;
-  fix_ling.l_linger = 0;
-  setsockopt(sock, SOL_SOCKET, SO_LINGER, &fix_ling, sizeof(fix_ling));
-  close(sock);
+static void core_peer_resolved(void *arg, const struct in_addr *addrs,
+			       int naddrs, const char *name)
+{
+  (void)arg;
+  if (naddrs > 0)
+    ncprint(NCPRINT_VERB1, _("Peer %s is %s"),
+	    netcat_inet_ntop(AF_INET, &addrs[0]), name);
 }
 
 /* This function loops inside the accept() loop until a VALID connection is
@@ -462,14 +688,14 @@ static int core_tcp_listen(nc_sock_t *ncsock)
       goto refuse;
     }
 
-    /* FIXME: _resolvehost must require verbosity >= 2 for DNS-resolving this
-       request */
-
     netcat_getport(&ncsock->port, NULL, ntohs(myaddr.sin_port));
-    //netcat_resolvehost(&ncsock->remote, NULL, &myaddr.sin_addr);
-
     ncprint(NCPRINT_VERB1, _("Connection from %s:%hu"),
-	    ncsock->remote.host.name, ncsock->port.num);
+	    netcat_inet_ntop(AF_INET, &myaddr.sin_addr), ncsock->port.num);
+
+    /* the name of the peer is looked up by the built-in resolver while the
+       data is already flowing, so a slow DNS never delays the session */
+    if (netcat_dns_enabled() && !opt_numeric && is_logging_enabled())
+      netcat_dns_query_ptr(myaddr.sin_addr, core_peer_resolved, NULL);
 
     /* with zero I/O mode we don't really accept any connection */
     if (opt_zero)
@@ -479,7 +705,7 @@ static int core_tcp_listen(nc_sock_t *ncsock)
     break;
 
  refuse:
-    close_reset(sock_accept);
+    netcat_close_reset(sock_accept);
     continue;
   }			/* end of infinite accepting loop */
 
@@ -520,16 +746,551 @@ int core_listen(nc_sock_t *ncsock)
   return -1;
 }
 
+/* The ends of a connected UDP socket, as core_readwrite() deals with them */
+
+typedef struct {
+  struct sockaddr_in peer;	/* the only sender taken, AF_UNSPEC for any */
+  struct in_addr src;		/* source address of the datagrams sent, or
+				   INADDR_ANY to leave it to the kernel */
+} core_dgram_t;
+
+/* Fills `dg' for the connection record `ncsock'.  A UDP socket connected by
+   core_udp_listen() may still hold the datagrams sent by other peers before
+   the connect, which must be dropped, and if it's bound to any address its
+   datagrams must be sent from the address the peer wrote to, which is then
+   stored as the local address.  In that case the socket is not connected at
+   all, and the peer is taken from the remote address of `ncsock'. */
+
+static void core_dgram_init(const nc_sock_t *ncsock, core_dgram_t *dg)
+{
+  unsigned int len = sizeof(dg->peer);
+#ifdef USE_SENDSRC
+  struct sockaddr_in my_addr;
+  struct in_addr src = ncsock->local.host.iaddrs[0];
+#endif
+
+  memset(dg, 0, sizeof(*dg));
+  if ((ncsock->domain == PF_UNSPEC) || (ncsock->proto != NETCAT_PROTO_UDP))
+    return;
+  if (getpeername(ncsock->fd, (struct sockaddr *)&dg->peer, &len) < 0) {
+    memset(&dg->peer, 0, sizeof(dg->peer));
+    if ((errno != ENOTCONN) || !ncsock->remote.host.iaddrs[0].s_addr ||
+	!ncsock->port.netnum)
+      return;
+    dg->peer.sin_family = AF_INET;
+    dg->peer.sin_addr = ncsock->remote.host.iaddrs[0];
+    dg->peer.sin_port = ncsock->port.netnum;
+  }
+  else if (dg->peer.sin_family != AF_INET) {
+    memset(&dg->peer, 0, sizeof(dg->peer));
+    return;
+  }
+
+#ifdef USE_SENDSRC
+  len = sizeof(my_addr);
+  if (src.s_addr && !IN_MULTICAST(ntohl(src.s_addr)) &&
+      !getsockname(ncsock->fd, (struct sockaddr *)&my_addr, &len) &&
+      (my_addr.sin_addr.s_addr != src.s_addr))
+    dg->src = src;
+#endif
+}
+
+/* Returns TRUE if the datagram received from `addr' belongs to the
+   connection described by `dg' */
+
+static bool core_dgram_from(const core_dgram_t *dg,
+			    const struct sockaddr_in *addr)
+{
+  if ((dg->peer.sin_family != AF_INET) ||
+      ((addr->sin_addr.s_addr == dg->peer.sin_addr.s_addr) &&
+       (addr->sin_port == dg->peer.sin_port)))
+    return TRUE;
+
+  debug_v(("dropped datagram from %s:%d",
+	  netcat_inet_ntop(AF_INET, &addr->sin_addr), ntohs(addr->sin_port)));
+  return FALSE;
+}
+
+/* Receives a datagram from the UDP socket `fd' like recv(2) does with the
+   MSG_TRUNC flag.  Returns -1 with errno set to EAGAIN if the datagram was
+   dropped because it doesn't belong to the connection described by `dg'. */
+
+static int core_recv(int fd, const core_dgram_t *dg, unsigned char *buf,
+		     size_t size)
+{
+  struct sockaddr_in addr;
+  unsigned int addr_len = sizeof(addr);
+  int ret;
+
+  memset(&addr, 0, sizeof(addr));
+  ret = recvfrom(fd, buf, size, MSG_TRUNC, (struct sockaddr *)&addr,
+		 &addr_len);
+  if ((ret >= 0) && !core_dgram_from(dg, &addr)) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return ret;
+}
+
+/* Writes `len' bytes of `data' to `fd' like write(2) does, but if `dg' is
+   not NULL and has a source address the datagram is sent from there, to the
+   peer of `dg' (the socket is not connected then, see core_udp_listen()). */
+
+static int core_send(int fd, const core_dgram_t *dg, const void *data,
+		     size_t len)
+{
+#ifdef USE_SENDSRC
+  if (dg && dg->src.s_addr) {
+    struct msghdr hdr;
+    struct iovec iov;
+    union {
+      struct cmsghdr align;
+      char buf[NETCAT_DSTADDR_SPACE];
+    } ctrl;
+
+    memset(&hdr, 0, sizeof(hdr));
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    hdr.msg_name = (void *)&dg->peer;
+    hdr.msg_namelen = sizeof(dg->peer);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl.buf;
+    udphelper_ancillary_src(&hdr, dg->src);
+    return sendmsg(fd, &hdr, 0);
+  }
+#else
+  (void)dg;
+#endif
+  return write(fd, data, len);
+}
+
+#ifdef USE_MMSG
+/* A coalesced receive holds at most 64 datagrams, and a segmented send can't
+   carry more than 64 datagrams nor more than the largest UDP payload. */
+#ifdef USE_UDP_OFFLOAD
+# define CORE_OFFLOAD_SEGS 64
+#else
+# define CORE_OFFLOAD_SEGS 1
+#endif
+#define CORE_OFFLOAD_MAX 65507
+
+/* Maximum number of datagrams in a batch, once the coalesced receives are
+   split back in datagrams */
+#define CORE_BATCH_DGRAMS (NETCAT_UDP_BATCH * CORE_OFFLOAD_SEGS)
+
+/* Ancillary data buffer, aligned for the cmsghdr structure.  It fits the
+   size of the coalesced datagrams and the counter of the dropped ones, or
+   the size of the segmented sends and their source address. */
+#ifdef USE_SENDSRC
+# define CORE_SENDSRC_SPACE NETCAT_DSTADDR_SPACE
+#else
+# define CORE_SENDSRC_SPACE 0
+#endif
+typedef union {
+  char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(unsigned int)) +
+	   CORE_SENDSRC_SPACE];
+  struct cmsghdr align;
+} core_cmsg_t;
+
+/* A batch of datagrams.  It is allocated once by core_readwrite() and then
+   reused for each batch, in both directions. */
+
+typedef struct {
+  struct mmsghdr msgs[NETCAT_UDP_BATCH];	/* received messages */
+  struct iovec iovs[NETCAT_UDP_BATCH];
+  struct sockaddr_in addrs[NETCAT_UDP_BATCH];
+  core_cmsg_t ctrl[NETCAT_UDP_BATCH];
+  unsigned char *bufs;		/* receive buffers */
+  struct iovec dgrams[CORE_BATCH_DGRAMS];	/* datagrams received */
+  int from[CORE_BATCH_DGRAMS];	/* message holding each datagram */
+  int count;			/* number of datagrams received */
+  bool eof;			/* an empty datagram was received */
+  bool cut;			/* the datagrams were cut from a stream */
+  size_t chunk;			/* size of the datagrams cut from a stream */
+  struct mmsghdr out[CORE_BATCH_DGRAMS];	/* messages to be sent */
+  struct iovec out_iovs[2 * CORE_BATCH_DGRAMS];	/* datagrams and framing */
+  unsigned char out_hdrs[CORE_BATCH_DGRAMS][2];	/* framing lengths */
+  int out_dgrams[CORE_BATCH_DGRAMS];	/* datagrams in each message */
+  core_cmsg_t out_ctrl[CORE_BATCH_DGRAMS];
+} core_batch_t;
+
+#ifdef USE_UDP_OFFLOAD
+/* Enables the coalesced receives (GRO) on the UDP socket `sock' and finds out
+   whether the segmented sends (GSO) can be used, storing the answer in
+   `gso'. */
+
+static void core_udp_offload(int sock, bool *gso)
+{
+  int sockopt = 0;
+  unsigned int sockopt_len = sizeof(sockopt);
+
+  *gso = (getsockopt(sock, SOL_UDP, UDP_SEGMENT, &sockopt, &sockopt_len) == 0);
+  sockopt = 1;
+  setsockopt(sock, SOL_UDP, UDP_GRO, &sockopt, sizeof(sockopt));
+}
+#endif
+
+/* Allocates a new batch.  Each buffer fits the largest datagram, which is
+   also the largest coalesced receive. */
+
+static core_batch_t *core_batch_new(void)
+{
+  core_batch_t *batch = malloc(sizeof(*batch));
+
+  batch->bufs = malloc(NETCAT_UDP_BATCH * NETCAT_DGRAM_MAX);
+  batch->chunk = CORE_DGRAM_SIZE;
+  return batch;
+}
+
+static void core_batch_free(core_batch_t *batch)
+{
+  if (!batch)
+    return;
+  free(batch->bufs);
+  free(batch);
+}
+
+/* Appends the datagram `data' of `len' bytes, found in the message `msg', to
+   the datagrams received */
+
+static void core_batch_add(core_batch_t *batch, int msg, unsigned char *data,
+			   size_t len)
+{
+  if (batch->count == CORE_BATCH_DGRAMS)
+    return;
+  batch->dgrams[batch->count].iov_base = data;
+  batch->dgrams[batch->count].iov_len = len;
+  batch->from[batch->count++] = msg;
+}
+
+/* Reads a batch of datagrams from `fd'.  If `stream' is TRUE the descriptor
+   is not a datagram socket (e.g. stdin): the data read with a single readv(2)
+   call is split in datagrams just like consecutive read(2) calls would do.
+   The coalesced receives are split back in the original datagrams.  An empty
+   datagram means EOF as it does for read(2), so it ends the batch and sets
+   the `eof' flag.  The datagrams that don't belong to the connection
+   described by `dg' (queued before the socket was connected) are dropped.
+   `drops' holds the last known count of datagrams dropped by the kernel for
+   this socket.
+   Returns the number of datagrams read, 0 on EOF, or -1 on error.  If all
+   the datagrams were dropped, errno is set to EAGAIN. */
+
+static int core_batch_recv(int fd, core_batch_t *batch, bool stream,
+			   const core_dgram_t *dg, unsigned int *drops)
+{
+  int i, n;
+
+  for (i = 0; i < NETCAT_UDP_BATCH; i++) {
+    struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+
+    memset(&batch->msgs[i], 0, sizeof(batch->msgs[i]));
+    batch->iovs[i].iov_base = batch->bufs + i * NETCAT_DGRAM_MAX;
+    batch->iovs[i].iov_len = (stream ? batch->chunk : NETCAT_DGRAM_MAX);
+    hdr->msg_iov = &batch->iovs[i];
+    hdr->msg_iovlen = 1;
+    hdr->msg_name = &batch->addrs[i];
+    hdr->msg_namelen = sizeof(batch->addrs[i]);
+    hdr->msg_control = batch->ctrl[i].buf;
+    hdr->msg_controllen = sizeof(batch->ctrl[i].buf);
+  }
+  batch->count = 0;
+  batch->eof = FALSE;
+  batch->cut = stream;
+
+  if (stream) {
+    ssize_t len = readv(fd, batch->iovs, NETCAT_UDP_BATCH);
+
+    if (len <= 0)
+      return len;
+    for (i = 0; len > 0; i++) {
+      size_t part = ((size_t)len > batch->chunk ? batch->chunk : (size_t)len);
+
+      core_batch_add(batch, i, batch->iovs[i].iov_base, part);
+      len -= part;
+    }
+    return batch->count;
+  }
+
+  /* wait for the first datagram only, then take what is already queued */
+  n = recvmmsg(fd, batch->msgs, NETCAT_UDP_BATCH, MSG_WAITFORONE, NULL);
+  if (n < 0)
+    return -1;
+
+  for (i = 0; i < n; i++) {
+    unsigned char *data = batch->iovs[i].iov_base;
+    size_t len = batch->msgs[i].msg_len, seg = len;
+#ifdef USE_UDP_OFFLOAD
+    struct msghdr *hdr = &batch->msgs[i].msg_hdr;
+    struct cmsghdr *cmsg;
+
+    /* a coalesced receive carries the size of its datagrams, only the last
+       one may be shorter */
+    for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg))
+      if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO)) {
+	int gro_size;
+
+	memcpy(&gro_size, CMSG_DATA(cmsg), sizeof(gro_size));
+	if (gro_size > 0)
+	  seg = gro_size;
+      }
+#endif
+
+#ifdef USE_RXQ_OVFL
+    udphelper_ancillary_drops(&batch->msgs[i].msg_hdr, drops);
+#endif
+    if (!core_dgram_from(dg, &batch->addrs[i]))
+      continue;
+    if (len == 0) {
+      batch->eof = TRUE;
+      break;
+    }
+    if (batch->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+      ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+	      _("Datagram from %s:%d truncated to %d bytes"),
+	      netcat_inet_ntop(AF_INET, &batch->addrs[i].sin_addr),
+	      ntohs(batch->addrs[i].sin_port), (int)len);
+    while (len > 0) {
+      size_t part = (len > seg ? seg : len);
+
+      core_batch_add(batch, i, data, part);
+      data += part;
+      len -= part;
+    }
+  }
+  dgrams_recv += batch->count;
+  if ((batch->count == 0) && !batch->eof) {
+    errno = EAGAIN;
+    return -1;
+  }
+  return batch->count;
+}
+
+#ifdef USE_PMTU
+/* Handles the `count' datagrams of `batch' from `first' on, refused by the
+   socket `fd' because they don't fit the path MTU any more.  The chunks cut
+   from a stream are split again at the new size and sent, while the whole
+   datagrams and records are dropped (their length is cleared).  `dg' is
+   passed to core_send(). */
+
+static void core_batch_toobig(int fd, const core_dgram_t *dg,
+			      core_batch_t *batch, int first, int count)
+{
+  int i, mtu = netcat_socket_mtu(fd);
+
+  if ((mtu > 0) && ((size_t)mtu != batch->chunk) && batch->cut) {
+    ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+	    _("Path MTU changed, sending datagrams of %d bytes"), mtu);
+    batch->chunk = mtu;
+  }
+
+  for (i = first; i < first + count; i++) {
+    unsigned char *data = batch->dgrams[i].iov_base;
+    size_t len = batch->dgrams[i].iov_len;
+
+    dgrams_toobig++;
+    if (!batch->cut || (mtu <= 0)) {
+      batch->dgrams[i].iov_len = 0;
+      continue;
+    }
+    while (len > 0) {
+      size_t part = (len > (size_t)mtu ? (size_t)mtu : len);
+
+      if (core_send(fd, dg, data, part) < 0) {
+	debug_v(("core_batch_toobig(): %s", strerror(errno)));
+	break;
+      }
+      data += part;
+      len -= part;
+    }
+  }
+}
+#endif
+
+/* Writes all the datagrams of `batch' to `fd' with writev(2) and the framing
+   chosen with `--framing' if `stream' is TRUE, or else keeping each one
+   separate with sendmmsg(2), from the source address of `dg' if it has one.
+   If `gso' is set each run of datagrams of the same size is sent as a single
+   segmented message; `gso' is cleared if the kernel refuses them.
+   Returns 0 on success or -1 on error (errno is set). */
+
+static int core_batch_send(int fd, const core_dgram_t *dg,
+			   core_batch_t *batch, bool stream, bool *gso)
+{
+  int i, n, ret, done = 0;
+
+  if (stream) {
+    int iovs = 0;
+
+    /* the vector is trimmed after a short write, so work on a copy */
+    for (i = 0; i < batch->count; i++)
+      iovs += netcat_framing_iov(&batch->out_iovs[iovs], batch->out_hdrs[i],
+				 batch->dgrams[i].iov_base,
+				 batch->dgrams[i].iov_len);
+    while (done < iovs) {
+      n = iovs - done;
+      ret = writev(fd, &batch->out_iovs[done], (n > IOV_MAX ? IOV_MAX : n));
+      if (ret < 0) {
+	if (errno == EINTR)
+	  continue;
+	return -1;
+      }
+
+      /* skip the vectors written completely, and trim the partial one */
+      while ((done < iovs) && ((size_t)ret >= batch->out_iovs[done].iov_len))
+	ret -= batch->out_iovs[done++].iov_len;
+      if (done < iovs) {
+	batch->out_iovs[done].iov_base =
+	  (char *)batch->out_iovs[done].iov_base + ret;
+	batch->out_iovs[done].iov_len -= ret;
+      }
+    }
+    return 0;
+  }
+
+  while (done < batch->count) {
+    for (n = 0, i = done; i < batch->count; n++) {
+      struct msghdr *hdr = &batch->out[n].msg_hdr;
+      size_t seg = batch->dgrams[i].iov_len, total = 0;
+      int segs = 0;
+
+      /* take the datagrams of the same size, and a shorter last one */
+      while (*gso && (i + segs < batch->count) &&
+	     (segs < CORE_OFFLOAD_SEGS) &&
+	     (batch->dgrams[i + segs].iov_len <= seg) &&
+	     (total + batch->dgrams[i + segs].iov_len <= CORE_OFFLOAD_MAX)) {
+	total += batch->dgrams[i + segs].iov_len;
+	if (batch->dgrams[i + segs++].iov_len < seg)
+	  break;
+      }
+      if (segs == 0)
+	segs = 1;
+
+      /* the sockets are connected, so there's no destination address
+	 unless a source address is chosen (see core_send()) */
+      memset(&batch->out[n], 0, sizeof(batch->out[n]));
+      hdr->msg_iov = &batch->dgrams[i];
+      hdr->msg_iovlen = segs;
+      batch->out_dgrams[n] = segs;
+#ifdef USE_UDP_OFFLOAD
+      if (segs > 1) {
+	struct cmsghdr *cmsg;
+	unsigned short gso_size = seg;
+
+	hdr->msg_control = batch->out_ctrl[n].buf;
+	hdr->msg_controllen = CMSG_SPACE(sizeof(gso_size));
+	cmsg = CMSG_FIRSTHDR(hdr);
+	cmsg->cmsg_level = SOL_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(gso_size));
+	memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+      }
+#endif
+#ifdef USE_SENDSRC
+      if (dg->src.s_addr) {
+	hdr->msg_name = (void *)&dg->peer;
+	hdr->msg_namelen = sizeof(dg->peer);
+	hdr->msg_control = batch->out_ctrl[n].buf;
+	udphelper_ancillary_src(hdr, dg->src);
+      }
+#endif
+      i += segs;
+    }
+
+    ret = sendmmsg(fd, batch->out, n, 0);
+    if (ret < 0) {
+      if (errno == EINTR)
+	continue;
+      /* the segmented sends may be refused by the device (EIO) or for
+	 datagrams that don't fit the path MTU (EINVAL) */
+      if (*gso && ((errno == EIO) || (errno == EINVAL))) {
+	debug_v(("segmented send refused, sending one datagram at a time"));
+	*gso = FALSE;
+	continue;
+      }
+#ifdef USE_PMTU
+      /* the first message doesn't fit the path MTU (see `--pmtu') */
+      if (errno == EMSGSIZE) {
+	core_batch_toobig(fd, dg, batch, done, batch->out_dgrams[0]);
+	done += batch->out_dgrams[0];
+	continue;
+      }
+#endif
+      return -1;
+    }
+    for (i = 0; i < ret; i++)
+      done += batch->out_dgrams[i];
+  }
+  return 0;
+}
+
+/* Sends the datagrams of `batch', read from stdin, to the socket `fd' (see
+   core_batch_send()) */
+
+static void core_batch_forward(int fd, const core_dgram_t *dg,
+			       core_batch_t *batch, bool *gso)
+{
+  int i;
+
+  if (core_batch_send(fd, dg, batch, FALSE, gso) < 0) {
+    perror("sendmmsg(net)");
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < batch->count; i++) {
+    /* skip the datagrams dropped by core_batch_toobig() */
+    if (batch->dgrams[i].iov_len == 0)
+      continue;
+    bytes_sent += batch->dgrams[i].iov_len;
+    if (opt_hexdump) {
+#ifndef USE_OLD_HEXDUMP
+      fprintf(output_fp, "Sent %u bytes to the socket\n",
+	      (unsigned int)batch->dgrams[i].iov_len);
+#endif
+      netcat_fhexdump(output_fp, '>', batch->dgrams[i].iov_base,
+		      batch->dgrams[i].iov_len);
+    }
+  }
+}
+
+/* Takes the complete records found by `fr' as the datagrams of `batch'.
+   Returns the number of datagrams taken. */
+
+static int core_batch_frame(core_batch_t *batch, nc_framer_t *fr)
+{
+  unsigned char *data;
+  size_t len;
+
+  batch->count = 0;
+  batch->eof = FALSE;
+  batch->cut = FALSE;
+  while ((batch->count < CORE_BATCH_DGRAMS) &&
+	 netcat_framer_next(fr, &data, &len))
+    core_batch_add(batch, 0, data, len);
+  return batch->count;
+}
+#endif
+
 /* handle stdin/stdout/network I/O. */
 
 int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
 {
   int fd_stdin, fd_stdout, fd_sock, fd_max;
-  int read_ret, write_ret;
-  unsigned char buf[1024];
+  int read_ret, write_ret, chunk = CORE_DGRAM_SIZE;
+  unsigned char buf[NETCAT_DGRAM_MAX];
   bool inloop = TRUE;
   fd_set ins, outs;
   struct timeval delayer;
+  core_dgram_t dg_main, dg_slave;
+#ifdef USE_MMSG
+  core_batch_t *batch = NULL;
+  bool slave_dgram = ((nc_slave->domain != PF_UNSPEC) &&
+		      (nc_slave->proto == NETCAT_PROTO_UDP));
+  bool gso_main = FALSE, gso_slave = FALSE;
+  unsigned int drops_main = 0, drops_slave = 0;
+  nc_framer_t framer;
+  bool framing = FALSE;
+#endif
   assert(nc_main && nc_slave);
 
   debug_v(("core_readwrite(nc_main=%p, nc_slave=%p)", (void *)nc_main,
@@ -551,6 +1312,43 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
   fd_max = 1 + (fd_stdin > fd_sock ? fd_stdin : fd_sock);
   delayer.tv_sec = 0;
   delayer.tv_usec = 0;
+  core_dgram_init(nc_main, &dg_main);
+  core_dgram_init(nc_slave, &dg_slave);
+
+#ifdef USE_PMTU
+  /* the datagrams can't be fragmented, so fill them up to the path MTU */
+  if ((nc_main->proto == NETCAT_PROTO_UDP) && nc_main->opts.pmtu) {
+    int mtu = netcat_socket_mtu(fd_sock);
+
+    if (mtu > 0) {
+      chunk = mtu;
+      ncprint(NCPRINT_VERB1, _("Path MTU allows datagrams of %d bytes"), chunk);
+    }
+  }
+#endif
+
+  /* in UDP mode the data is moved a batch of datagrams at a time, straight
+     from one side to the other.  Telnet codes and the delayed output need
+     the queues, so they keep using the common path.  Where the kernel
+     supports it, the runs of datagrams of the same size are segmented and
+     the received ones are coalesced by the kernel as well.  With `--framing'
+     the datagrams are marked on the stream side, so that each record read
+     is sent as a datagram of its own. */
+#ifdef USE_MMSG
+  if ((nc_main->proto == NETCAT_PROTO_UDP) && !opt_telnet && !opt_interval) {
+#ifdef USE_UDP_OFFLOAD
+    core_udp_offload(fd_sock, &gso_main);
+    if (slave_dgram)
+      core_udp_offload(fd_stdin, &gso_slave);
+#endif
+    batch = core_batch_new();
+    batch->chunk = chunk;
+    if (opt_framing && !slave_dgram) {
+      framing = TRUE;
+      netcat_framer_init(&framer);
+    }
+  }
+#endif
 
   /* use the internal signal handler */
   signal_handler = FALSE;
@@ -559,6 +1357,7 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
     bool call_select = TRUE;
     struct sockaddr_in recv_addr;	/* only used by UDP proto */
     unsigned int recv_len = sizeof(recv_addr);
+    int fd_dns;
 
     /* if we received an interrupt signal break this function */
     if (got_sigint) {
@@ -607,8 +1406,24 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
       }
     }
 
+    /* the answers to the lookups of the built-in resolver (if any) are
+       processed here as well, waking up to send the queries again */
+    if ((fd_dns = netcat_dns_fd()) >= 0)
+      FD_SET(fd_dns, &ins);
+
     if (call_select || delayer.tv_sec || delayer.tv_usec) {
       int ret;
+      struct timeval dns_tt, *wait = NULL;
+
+      if (delayer.tv_sec || delayer.tv_usec)
+	wait = &delayer;
+      else if (fd_dns >= 0) {
+	unsigned long long now = netcat_time_usec(), when = netcat_dns_timeout();
+
+	dns_tt.tv_sec = (when > now ? (when - now) / 1000000 : 0);
+	dns_tt.tv_usec = (when > now ? (when - now) % 1000000 : 0);
+	wait = &dns_tt;
+      }
 #ifndef USE_LINUX_SELECT
       struct timeval dd_saved;
 
@@ -618,8 +1433,8 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
 #endif
 
       debug(("[select] entering with timeout=%d:%d ...", delayer.tv_sec, delayer.tv_usec));
-      ret = select(fd_max, &ins, &outs, NULL,
-		   (delayer.tv_sec || delayer.tv_usec ? &delayer : NULL));
+      ret = select((fd_dns >= fd_max ? fd_dns + 1 : fd_max), &ins, &outs,
+		   NULL, wait);
 
 #ifndef USE_LINUX_SELECT
       delayer.tv_sec = dd_saved.tv_sec;
@@ -641,6 +1456,8 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
       call_select = TRUE;
       debug(("ret=%d\n", ret));
     }
+    if (fd_dns >= 0)
+      netcat_dns_process();
 
     /* reading from stdin the incoming data.  The data is currently in the
        kernel's receiving queue, and in this session we move that data to our
@@ -648,12 +1465,48 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
        this queue is empty now because otherwise this fd wouldn't have been
        watched. */
     if (call_select && FD_ISSET(fd_stdin, &ins)) {
-      read_ret = read(fd_stdin, buf, sizeof(buf));
+      bool batched = FALSE;
+
+#ifdef USE_MMSG
+      if (batch && (nc_main->sendq.len == 0)) {
+	batched = TRUE;
+	if (framing) {
+	  /* the records completed by this read are sent right away, a batch
+	     at a time, while a partial one waits for the next read */
+	  read_ret = netcat_framer_fill(&framer, fd_stdin);
+	  debug_dv(("read(stdin) = %d", read_ret));
+	  while (core_batch_frame(batch, &framer) > 0)
+	    core_batch_forward(fd_sock, &dg_main, batch, &gso_main);
+	}
+	else {
+	  read_ret = core_batch_recv(fd_stdin, batch, !slave_dgram, &dg_slave,
+				     &drops_slave);
+	  debug_dv(("core_batch_recv(stdin) = %d", read_ret));
+	  if (read_ret > 0) {
+	    core_batch_forward(fd_sock, &dg_main, batch, &gso_main);
+	    if (batch->eof)
+	      read_ret = 0;
+	  }
+	}
+      }
+      else
+#endif
+      if (dg_slave.peer.sin_family == AF_INET) {
+	read_ret = core_recv(fd_stdin, &dg_slave, buf, chunk);
+	/* the rest of a longer datagram is lost, as with read(2) */
+	if (read_ret > chunk)
+	  read_ret = chunk;
+      }
+      else
+	read_ret = read(fd_stdin, buf, chunk);
       debug_dv(("read(stdin) = %d", read_ret));
 
       if (read_ret < 0) {
-	perror("read(stdin)");
-	exit(EXIT_FAILURE);
+	/* EAGAIN means that only the datagrams of other peers were there */
+	if (errno != EAGAIN) {
+	  perror("read(stdin)");
+	  exit(EXIT_FAILURE);
+	}
       }
       else if (read_ret == 0) {
 	/* when we receive EOF and this is a tunnel say goodbye, otherwise
@@ -667,7 +1520,7 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
 	  use_stdin = FALSE;
 	}
       }
-      else {
+      else if (!batched) {
 	/* we can overwrite safely since if the receive queue is busy this fd
 	   is not watched at all. */
         nc_slave->recvq.len = read_ret;
@@ -730,10 +1583,28 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
 	delayer.tv_sec = opt_interval;
       }
 
-      write_ret = write(fd_sock, data, data_len);
+      /* each write is a datagram, and it may have to fit a smaller path MTU
+	 than the chunks read */
+      if ((nc_main->proto == NETCAT_PROTO_UDP) && (data_len > chunk))
+	data_len = chunk;
+
+      write_ret = core_send(fd_sock, &dg_main, data, data_len);
       if (write_ret < 0) {
 	if (errno == EAGAIN)
 	  write_ret = 0;	/* write would block, append it to select */
+#ifdef USE_PMTU
+	else if ((errno == EMSGSIZE) &&
+		 ((write_ret = netcat_socket_mtu(fd_sock)) > 0) &&
+		 (write_ret < data_len)) {
+	  /* the path MTU dropped, write the data again in smaller chunks */
+	  ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+		  _("Path MTU changed, sending datagrams of %d bytes"),
+		  write_ret);
+	  dgrams_toobig++;
+	  chunk = write_ret;
+	  write_ret = 0;
+	}
+#endif
 	else {
 	  perror("write(net)");
 	  exit(EXIT_FAILURE);
@@ -783,30 +1654,85 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
 
     /* reading from the socket (net). */
     if (call_select && FD_ISSET(fd_sock, &ins)) {
+      bool batched = FALSE;
+
+#ifdef USE_MMSG
+      if (batch && (nc_slave->sendq.len == 0)) {
+	int i;
+
+	batched = TRUE;
+	read_ret = core_batch_recv(fd_sock, batch, FALSE, &dg_main,
+				   &drops_main);
+	debug_dv(("core_batch_recv(net) = %d", read_ret));
+
+	if (read_ret > 0) {
+	  if (core_batch_send(fd_stdout, &dg_slave, batch, !slave_dgram,
+			      &gso_slave) < 0) {
+	    perror("write(stdout)");
+	    exit(EXIT_FAILURE);
+	  }
+
+	  for (i = 0; i < read_ret; i++) {
+	    const struct sockaddr_in *from = &batch->addrs[batch->from[i]];
+
+	    bytes_recv += batch->dgrams[i].iov_len;
+	    if (opt_hexdump) {
+#ifndef USE_OLD_HEXDUMP
+	      if (opt_zero)
+		fprintf(output_fp, "Received %u bytes from %s:%d\n",
+			(unsigned int)batch->dgrams[i].iov_len,
+			netcat_inet_ntop(AF_INET, &from->sin_addr),
+			ntohs(from->sin_port));
+	      else
+		fprintf(output_fp, "Received %u bytes from the socket\n",
+			(unsigned int)batch->dgrams[i].iov_len);
+#endif
+	      netcat_fhexdump(output_fp, '<', batch->dgrams[i].iov_base,
+			      batch->dgrams[i].iov_len);
+	    }
+	  }
+	  if (batch->eof)
+	    read_ret = 0;
+	}
+      }
+      else
+#endif
       if ((nc_main->proto == NETCAT_PROTO_UDP) && opt_zero) {
 	memset(&recv_addr, 0, sizeof(recv_addr));
 	/* this allows us to fetch packets from different addresses */
-	read_ret = recvfrom(fd_sock, buf, sizeof(buf), 0,
+	read_ret = recvfrom(fd_sock, buf, sizeof(buf), MSG_TRUNC,
 			    (struct sockaddr *)&recv_addr, &recv_len);
 	/* when recvfrom() call fails, recv_addr remains untouched */
 	debug_dv(("recvfrom(net) = %d (address=%s:%d)", read_ret,
 		netcat_inet_ntop(AF_INET, &recv_addr.sin_addr), ntohs(recv_addr.sin_port)));
       }
+      else if (nc_main->proto == NETCAT_PROTO_UDP)
+	read_ret = core_recv(fd_sock, &dg_main, buf, sizeof(buf));
       else {
 	/* common file read fallback */
 	read_ret = read(fd_sock, buf, sizeof(buf));
 	debug_dv(("read(net) = %d", read_ret));
       }
 
+      /* with MSG_TRUNC the real length of a truncated datagram is returned */
+      if (read_ret > (int)sizeof(buf)) {
+	ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+		_("Datagram truncated to %d bytes"), (int)sizeof(buf));
+	read_ret = sizeof(buf);
+      }
+
       if (read_ret < 0) {
-	perror("read(net)");
-	exit(EXIT_FAILURE);
+	/* EAGAIN means that only the datagrams of other peers were there */
+	if (errno != EAGAIN) {
+	  perror("read(net)");
+	  exit(EXIT_FAILURE);
+	}
       }
       else if (read_ret == 0) {
 	debug_v(("EOF Received from the net"));
 	inloop = FALSE;
       }
-      else {
+      else if (!batched) {
 	nc_main->recvq.len = read_ret;
 	nc_main->recvq.head = NULL;
 	nc_main->recvq.pos = buf;
@@ -844,7 +1770,7 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
       int data_len = nc_slave->sendq.len;
       nc_buffer_t *my_sendq = &nc_slave->sendq;
 
-      write_ret = write(fd_stdout, data, data_len);
+      write_ret = core_send(fd_stdout, &dg_slave, data, data_len);
       bytes_recv += write_ret;		/* update statistics */
       debug_dv(("write(stdout) = %d", write_ret));
 
@@ -911,6 +1837,12 @@ int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave)
     nc_slave->fd = -1;
   }
 
+#ifdef USE_MMSG
+  core_batch_free(batch);
+  if (framing)
+    netcat_framer_free(&framer);
+#endif
+
   /* restore the extarnal signal handler */
   signal_handler = TRUE;
 
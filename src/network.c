@@ -40,7 +40,7 @@
 
 bool netcat_resolvehost(nc_host_t *dst, const char *name)
 {
-  int i;
+  int i, ret;
   struct hostent *hostent;
   struct in_addr res_addr;
 #ifdef USE_IPV6
@@ -62,6 +62,22 @@ bool netcat_resolvehost(nc_host_t *dst, const char *name)
     if (opt_numeric)
       return TRUE;
 
+    /* only the names that passed the checks below are cached */
+    if ((ret = netcat_cache_get(NETCAT_CACHE_PTR, dst->host.addrs[0],
+				dst->host.name, MAXHOSTNAMELEN - 1)) >= 0) {
+      dst->host.name[ret] = 0;
+      return TRUE;
+    }
+
+    /* the built-in resolver takes the PTR record as it is, without checking
+       it with a direct lookup */
+    if (netcat_dns_enabled()) {
+      if (!netcat_dns_resolve_ptr(dst->host.name, res_addr))
+	ncprint(NCPRINT_VERB2 | NCPRINT_WARNING,
+		_("Inverse name lookup failed for `%s'"), name);
+      return TRUE;
+    }
+
     /* failures to look up a PTR record are *not* considered fatal */
     hostent = gethostbyaddr((char *)&res_addr, sizeof(res_addr), AF_INET);
     if (!hostent)
@@ -83,8 +99,12 @@ bool netcat_resolvehost(nc_host_t *dst, const char *name)
       }
       for (i = 0; hostent->h_addr_list[i] && (i < MAXINETADDRS); i++)
 	if (!memcmp(&dst->host.iaddrs[0], hostent->h_addr_list[i],
-		    sizeof(dst->host.iaddrs[0])))
-	  return TRUE;		/* resolving verified, it's AUTH */
+		    sizeof(dst->host.iaddrs[0]))) {
+	  /* resolving verified, it's AUTH */
+	  netcat_cache_put(NETCAT_CACHE_PTR, dst->host.addrs[0], dst->host.name,
+			   strlen(dst->host.name), NETCAT_CACHE_TTL);
+	  return TRUE;
+	}
 
       ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
 	      _("Host %s isn't authoritative! (direct lookup mismatch)"),
@@ -101,7 +121,7 @@ bool netcat_resolvehost(nc_host_t *dst, const char *name)
   /* same as above, but check for an IPv6 address notation */
   else if (netcat_inet_pton(AF_INET6, name, &res6_addr)) {
     memcpy(&dst->host6.iaddrs[0], &res6_addr, sizeof(dst->host6.iaddrs[0]));
-    strncpy(dst->host6.addrs[0], netcat_inet_ntop(AF_INET6, &res_addr), sizeof(dst->host6.addrs[0]));
+    strncpy(dst->host6.addrs[0], netcat_inet_ntop(AF_INET6, &res6_addr), sizeof(dst->host6.addrs[0]));
 
     /* if opt_numeric is set or we don't require verbosity, we are done */
     if (opt_numeric)
@@ -115,6 +135,21 @@ bool netcat_resolvehost(nc_host_t *dst, const char *name)
     if (opt_numeric)
       return FALSE;
 
+    /* the cached addresses are taken as they are, like the ones of the
+       built-in resolver */
+    if ((ret = netcat_cache_get_addrs(name, dst->host.iaddrs)) > 0) {
+      strncpy(dst->host.name, name, MAXHOSTNAMELEN - 1);
+      for (i = 0; i < ret; i++)
+	strncpy(dst->host.addrs[i], netcat_inet_ntop(AF_INET, &dst->host.iaddrs[i]),
+		sizeof(dst->host.addrs[0]));
+      return TRUE;
+    }
+
+    /* the built-in resolver may have the answer already (see the function
+       netcat_dns_prefetch()), and it doesn't do the inverse lookups */
+    if (netcat_dns_enabled())
+      return netcat_dns_resolve(dst, name);
+
     /* failures to look up a name are reported to the calling function */
     if (!(hostent = gethostbyname(name)))
       return FALSE;
@@ -135,6 +170,8 @@ bool netcat_resolvehost(nc_host_t *dst, const char *name)
       strncpy(dst->host.addrs[i], netcat_inet_ntop(AF_INET, &dst->host.iaddrs[i]),
 	      sizeof(dst->host.addrs[0]));
     }				/* end of foreach addr, part A */
+    netcat_cache_put(NETCAT_CACHE_HOST, name, dst->host.iaddrs,
+		     i * sizeof(dst->host.iaddrs[0]), NETCAT_CACHE_TTL);
 
     /* for speed purposes, skip the authoritative checking if we haven't got
        any verbosity level set.  note that this will cause invalid results
@@ -205,6 +242,79 @@ bool netcat_resolvehost(nc_host_t *dst, const char *name)
   return TRUE;
 }
 
+/* Adds the IPv6 addresses of the host `name' to the structure pointed to by
+   `dst', which must have been filled by netcat_resolvehost() (or cleared)
+   before, so that the connections can be attempted to the addresses of both
+   the families.  Numeric addresses are not looked up, since they are already
+   handled by netcat_resolvehost().
+   Returns TRUE if at least one IPv6 address was found. */
+
+bool netcat_resolvehost6(nc_host_t *dst, const char *name)
+{
+#if defined(USE_IPV6) && defined(HAVE_GETHOSTBYNAME2)
+  int i;
+  struct hostent *hostent;
+  struct in_addr res_addr;
+  struct in6_addr res6_addr;
+
+  assert(name && name[0]);
+  debug_v(("netcat_resolvehost6(dst=%p, name=\"%s\")", (void *)dst, name));
+
+  /* the built-in resolver only looks up IPv4 addresses */
+  if (opt_numeric || netcat_dns_enabled() ||
+      netcat_inet_pton(AF_INET, name, &res_addr) ||
+      netcat_inet_pton(AF_INET6, name, &res6_addr))
+    return FALSE;
+
+  hostent = gethostbyname2(name, AF_INET6);
+  if (!hostent || (hostent->h_addrtype != AF_INET6))
+    return FALSE;
+
+  strncpy(dst->host6.name, name, MAXHOSTNAMELEN - 1);
+  for (i = 0; hostent->h_addr_list[i] && (i < MAXINETADDRS); i++) {
+    memcpy(&dst->host6.iaddrs[i], hostent->h_addr_list[i],
+	   sizeof(dst->host6.iaddrs[0]));
+    strncpy(dst->host6.addrs[i], netcat_inet_ntop(AF_INET6, &dst->host6.iaddrs[i]),
+	    sizeof(dst->host6.addrs[0]));
+  }
+  return (i > 0);
+#else
+  return FALSE;
+#endif
+}
+
+/* The services database compiled in at build time from a services(5) file
+   (see services.awk).  Both the tables end with an empty entry, which is not
+   part of the binary search. */
+
+typedef struct {
+  unsigned short port;
+  char proto;			/* 't' for TCP or 'u' for UDP */
+  const char *name;		/* official name */
+  const char *alias;		/* name being looked up (services_byname) */
+} nc_service_t;
+
+#include "services.h"
+
+#define SERVICES_COUNT(__table) (sizeof(__table) / sizeof(__table[0]) - 1)
+
+static int services_cmp_port(const void *a, const void *b)
+{
+  const nc_service_t *sa = a, *sb = b;
+
+  if (sa->port != sb->port)
+    return (int)sa->port - (int)sb->port;
+  return sa->proto - sb->proto;
+}
+
+static int services_cmp_name(const void *a, const void *b)
+{
+  const nc_service_t *sa = a, *sb = b;
+  int ret = strcmp(sa->alias, sb->alias);
+
+  return (ret ? ret : sa->proto - sb->proto);
+}
+
 /* Identifies a port and fills in the netcat_port structure pointed to by
    `dst'.  If `port_name' is not NULL, it is used to identify the port
    (either by port name, listed in /etc/services, or by a string number).  In
@@ -217,6 +327,8 @@ bool netcat_getport(nc_port_t *dst, const char *port_name,
 {
   const char *get_proto = (opt_proto == NETCAT_PROTO_UDP ? "udp" : "tcp");
   struct servent *servent;
+  char key[NETCAT_MAXPORTNAMELEN + 8], value[NETCAT_MAXPORTNAMELEN + 2];
+  int len;
 
   debug_v(("netcat_getport(dst=%p, port_name=\"%s\", port_num=%hu)",
 	  (void *)dst, NULL_STR(port_name), port_num));
@@ -235,11 +347,37 @@ bool netcat_getport(nc_port_t *dst, const char *port_name,
       return FALSE;
     dst->num = port_num;
     dst->netnum = htons(port_num);
+
+    /* the compiled in table is complete, a port that is not there has no
+       name, so that a full range scan never goes through the system */
+    if (SERVICES_COUNT(services_byport) > 0) {
+      nc_service_t key_srv;
+      const nc_service_t *found;
+
+      key_srv.port = port_num;
+      key_srv.proto = get_proto[0];
+      found = bsearch(&key_srv, services_byport, SERVICES_COUNT(services_byport),
+		      sizeof(services_byport[0]), services_cmp_port);
+      if (found)
+	strncpy(dst->name, found->name, sizeof(dst->name) - 1);
+      goto end;
+    }
+
+    /* the ports without a name are cached too, with an empty name */
+    snprintf(key, sizeof(key), "%s/%hu", get_proto, port_num);
+    if ((len = netcat_cache_get(NETCAT_CACHE_SERVPORT, key, dst->name,
+				sizeof(dst->name) - 1)) >= 0) {
+      dst->name[len] = 0;
+      goto end;
+    }
+
     servent = getservbyport((int)dst->netnum, get_proto);
     if (servent) {
       assert(dst->netnum == servent->s_port);
-      strncpy(dst->name, servent->s_name, sizeof(dst->name));
+      strncpy(dst->name, servent->s_name, sizeof(dst->name) - 1);
     }
+    netcat_cache_put(NETCAT_CACHE_SERVPORT, key, dst->name, strlen(dst->name),
+		     NETCAT_CACHE_SERV_TTL);
     goto end;
   }
   else {
@@ -263,14 +401,52 @@ bool netcat_getport(nc_port_t *dst, const char *port_name,
     else if (endptr != port_name)	/* mixed numeric and string value */
       return FALSE;
 
-    /* this is a port name, try to lookup it */
+    /* names that are not compiled in may still be known to the system */
+    {
+      nc_service_t key_srv;
+      const nc_service_t *found;
+
+      key_srv.alias = port_name;
+      key_srv.proto = get_proto[0];
+      found = bsearch(&key_srv, services_byname, SERVICES_COUNT(services_byname),
+		      sizeof(services_byname[0]), services_cmp_name);
+      if (found) {
+	strncpy(dst->name, found->name, sizeof(dst->name) - 1);
+	dst->num = found->port;
+	dst->netnum = htons(found->port);
+	goto end;
+      }
+    }
+
+    /* this is a port name, try to lookup it.  The cached value is the port
+       number followed by the official name, or nothing for unknown names */
+    snprintf(key, sizeof(key), "%s/%.*s", get_proto, NETCAT_MAXPORTNAMELEN,
+	     port_name);
+    if ((len = netcat_cache_get(NETCAT_CACHE_SERVNAME, key, value,
+				sizeof(value))) >= 0) {
+      if ((len < 2) || (len >= (int)sizeof(value)))
+	return FALSE;
+      memcpy(&dst->netnum, value, 2);
+      memcpy(dst->name, value + 2, len - 2);
+      dst->name[len - 2] = 0;
+      dst->num = ntohs(dst->netnum);
+      goto end;
+    }
+
     servent = getservbyname(port_name, get_proto);
     if (servent) {
-      strncpy(dst->name, servent->s_name, sizeof(dst->name));
+      strncpy(dst->name, servent->s_name, sizeof(dst->name) - 1);
       dst->netnum = servent->s_port;
       dst->num = ntohs(dst->netnum);
+      len = strlen(dst->name);
+      memcpy(value, &dst->netnum, 2);
+      memcpy(value + 2, dst->name, len);
+      netcat_cache_put(NETCAT_CACHE_SERVNAME, key, value, len + 2,
+		       NETCAT_CACHE_SERV_TTL);
       goto end;
     }
+    netcat_cache_put(NETCAT_CACHE_SERVNAME, key, value, 0,
+		     NETCAT_CACHE_SERV_TTL);
     return FALSE;
   }
 
@@ -302,8 +478,9 @@ const char *netcat_strid(nc_domain_t domain, const nc_host_t *host,
       p += snprintf(p, sizeof(buf) + buf - p, "%s", host->host.addrs[0]);
   }
 #ifdef USE_IPV6
-  else if ((domain == NETCAT_DOMAIN_IPV6) && (host->host6.iaddrs[0].s6_addr32[0])) {
-    if (host->host6.name[0])  /* FIXME: s6_addr32[0] is only one part! not enough */
+  else if ((domain == NETCAT_DOMAIN_IPV6) &&
+	   !IN6_IS_ADDR_UNSPECIFIED(&host->host6.iaddrs[0])) {
+    if (host->host6.name[0])
       p += snprintf(p, sizeof(buf) + buf - p, "%s [%s]", host->host6.name,
 		    host->host6.addrs[0]);
     else
@@ -375,6 +552,87 @@ const char *netcat_inet_ntop(int af, const void *src)
   return ret;
 }			/* end of netcat_inet_ntop() */
 
+/* Applies the multicast options to the IPv4 UDP socket `sock': the TTL and
+   the interface of the datagrams sent, and the groups joined.  The
+   memberships don't depend on the address the socket is bound to, so they
+   can be set up right away.
+   Returns 0 on success, or -1 on error. */
+
+static int netcat_socket_mcast(int sock, const nc_sockopts_t *opts)
+{
+  int i, ret;
+
+  if (opts->mcast_ttl > 0) {
+    unsigned char ttl = opts->mcast_ttl;
+
+    if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)
+      return -1;
+  }
+  if (opts->mcast_if.s_addr &&
+      (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &opts->mcast_if,
+		  sizeof(opts->mcast_if)) < 0))
+    return -1;
+
+  for (i = 0; i < opts->joins; i++) {
+    const nc_mcast_t *m = &opts->join[i];
+
+#ifdef IP_ADD_SOURCE_MEMBERSHIP
+    if (m->source.s_addr) {
+      struct ip_mreq_source mreq;
+
+      memset(&mreq, 0, sizeof(mreq));
+      mreq.imr_multiaddr = m->group;
+      mreq.imr_interface = opts->mcast_if;
+      mreq.imr_sourceaddr = m->source;
+      ret = setsockopt(sock, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP, &mreq,
+		       sizeof(mreq));
+    }
+    else
+#endif
+    {
+      struct ip_mreq mreq;
+
+      memset(&mreq, 0, sizeof(mreq));
+      mreq.imr_multiaddr = m->group;
+      mreq.imr_interface = opts->mcast_if;
+      ret = setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+		       sizeof(mreq));
+    }
+    if (ret < 0) {
+      ncprint(NCPRINT_ERROR, _("Couldn't join the multicast group %s: %s"),
+	      netcat_inet_ntop(AF_INET, &m->group), strerror(errno));
+      return -1;
+    }
+    ncprint(NCPRINT_VERB2, _("Joined the multicast group %s"),
+	    netcat_inet_ntop(AF_INET, &m->group));
+  }
+  return 0;
+}
+
+/* Warns, once, when the kernel gave the socket `sock' a smaller receive
+   buffer than the `wanted' bytes, which happens to the unprivileged
+   SO_RCVBUF when the size is above the system wide limit. */
+
+static void netcat_socket_rcvbuf(int sock, int wanted)
+{
+  static bool warned = FALSE;
+  int got = 0;
+  socklen_t len = sizeof(got);
+
+  if (warned || (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &got, &len) < 0))
+    return;
+#ifdef SO_RCVBUFFORCE
+  /* Linux reports twice the size that was set, for its own bookkeeping */
+  got /= 2;
+#endif
+  if (got < wanted) {
+    ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+	    _("The receive buffer is limited to %d bytes instead of %d"),
+	    got, wanted);
+    warned = TRUE;
+  }
+}
+
 /* Backend for the socket(2) system call.  This function wraps the creation of
    new sockets and sets the common SO_REUSEADDR socket option, handling eventual errors.
    Returns -1 if the socket(2) call failed, -2 if the setsockopt() call failed;
@@ -420,6 +678,64 @@ int netcat_socket_new(nc_domain_t domain, nc_proto_t proto,
     return -2;
   }
 
+  /* a larger receive buffer absorbs the bursts.  The forced version ignores
+     the system wide limit, but it needs special privileges */
+  if (opts->rcvbuf > 0) {
+    sockopt = opts->rcvbuf;
+    ret = -1;
+#ifdef SO_RCVBUFFORCE
+    ret = setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &sockopt, sizeof(sockopt));
+#endif
+    if (ret < 0) {
+      ret = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &sockopt, sizeof(sockopt));
+      if (ret == 0)
+	netcat_socket_rcvbuf(sock, opts->rcvbuf);
+    }
+    if (ret < 0) {
+      close(sock);
+      return -2;
+    }
+  }
+
+#ifdef USE_RXQ_OVFL
+  /* have the datagrams dropped by the kernel counted in the ancillary data */
+  if (proto == NETCAT_PROTO_UDP) {
+    sockopt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &sockopt, sizeof(sockopt));
+  }
+#endif
+
+#ifdef USE_PMTU
+  /* the datagrams are sent with the DF bit set, and those larger than the
+     path MTU are refused with EMSGSIZE instead of being fragmented */
+  if (opts->pmtu && (proto == NETCAT_PROTO_UDP) && (sockdomain == PF_INET)) {
+    sockopt = IP_PMTUDISC_DO;
+    ret = setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, &sockopt, sizeof(sockopt));
+    if (ret < 0) {
+      close(sock);
+      return -2;
+    }
+  }
+#endif
+
+  if ((proto == NETCAT_PROTO_UDP) && (sockdomain == PF_INET) &&
+      (netcat_socket_mcast(sock, opts) < 0)) {
+    close(sock);
+    return -2;
+  }
+
+#ifdef SO_REUSEPORT
+  /* the sockets bound to the same port share its datagrams */
+  if (opts->reuseport) {
+    sockopt = 1;
+    ret = setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &sockopt, sizeof(sockopt));
+    if (ret < 0) {
+      close(sock);
+      return -2;
+    }
+  }
+#endif
+
   return sock;
 }
 
@@ -499,26 +815,63 @@ int netcat_connect(int sock, nc_domain_t domain, const nc_host_t *addr, const nc
   return ret;
 }
 
+#ifdef USE_PMTU
+/* Finds out the largest UDP payload that fits the path MTU known by the
+   kernel for the connected IPv4 socket `sock'.
+   Returns the payload size, or -1 if the MTU is not known. */
+
+int netcat_socket_mtu(int sock)
+{
+  int mtu;
+  unsigned int mtu_len = sizeof(mtu);
+
+  if (getsockopt(sock, IPPROTO_IP, IP_MTU, &mtu, &mtu_len) < 0)
+    return -1;
+
+  /* the IPv4 header without options and the UDP header are not payload, and
+     the loopback MTU exceeds the largest datagram */
+  mtu -= 28;
+  return (mtu > 65507 ? 65507 : mtu);
+}
+#endif
+
+/* Close the socket by sending a reset (RST) instead of FIN, so that the peer
+   gets a connection reset error.  This also skips the TIME_WAIT state on our
+   side, so the local port can be reused at once. */
+
+void netcat_close_reset(int sock)
+{
+  struct linger fix_ling;
+
+  fix_ling.l_onoff = 1;
+  fix_ling.l_linger = 0;
+  setsockopt(sock, SOL_SOCKET, SO_LINGER, &fix_ling, sizeof(fix_ling));
+  close(sock);
+}
+
 /* Creates a full outgoing async socket connection in the specified `domain'
-   and `type' to the specified `addr' and `port'.  The connection is
-   originated using the optionally specified `local_addr' and `local_port'.
-   If `local_addr' is NULL and `local_port' is 0 the bind(2) call is skipped.
+   and `type' to the socket address `addr', which is `addr_len' bytes long.
+   The connection is originated from the optional local socket address
+   `local' (`local_len' bytes long); if it is NULL the bind(2) call is
+   skipped.  This is the backend of netcat_socket_new_connect(), for the
+   callers that already keep their addresses in this form.
    Returns the descriptor referencing the new socket on success, otherwise
    returns -1 or -2 if socket creation failed (see netcat_socket_new()),
    or -3 if the bind(2) call failed, -4 if the fcntl(2) call failed, or -5
    if the connect(2) call failed. */
 
-int netcat_socket_new_connect(nc_domain_t domain, nc_proto_t proto,
-			      const nc_host_t *addr, const nc_port_t *port,
-			      const nc_host_t *local_addr, const nc_port_t *local_port,
-			      const nc_sockopts_t *opts)
+int netcat_socket_new_connect_sa(nc_domain_t domain, nc_proto_t proto,
+				 const struct sockaddr *addr,
+				 unsigned int addr_len,
+				 const struct sockaddr *local,
+				 unsigned int local_len,
+				 const nc_sockopts_t *opts)
 {
   int sock, ret;
   assert(addr);
 
-  debug_dv(("netcat_socket_new_connect(domain=%d, addr=%p, port=%hu, "
-	    "local_addr=%p, local_port=%hu)", domain, (void *)addr, port->num,
-	    (void *)local_addr, local_port->num));
+  debug_dv(("netcat_socket_new_connect_sa(domain=%d, addr=%p, local=%p)",
+	    domain, (void *)addr, (void *)local));
 
   /* create the socket and fix the options */
   sock = netcat_socket_new(domain, proto, opts);
@@ -526,8 +879,21 @@ int netcat_socket_new_connect(nc_domain_t domain, nc_proto_t proto,
     return sock;		/* just forward the error code */
 
   /* only if needed, bind it to a local address */
-  if (local_addr || local_port->num) {
-    ret = netcat_bind(sock, domain, local_addr, local_port);
+  if (local) {
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    /* binding just the address would reserve a local port for any possible
+       destination.  Let the kernel pick it at connect(2) time instead, so
+       that the same port can be shared by connections to different hosts.
+       The port is at the same offset in both the IPv4 and IPv6 structures. */
+    if (!((const struct sockaddr_in *)local)->sin_port &&
+	(proto == NETCAT_PROTO_TCP)) {
+      int sockopt = 1;
+
+      setsockopt(sock, SOL_IP, IP_BIND_ADDRESS_NO_PORT, &sockopt,
+		 sizeof(sockopt));
+    }
+#endif
+    ret = bind(sock, local, local_len);
     if (ret < 0) {
       ret = -3;
       goto err;
@@ -545,7 +911,7 @@ int netcat_socket_new_connect(nc_domain_t domain, nc_proto_t proto,
   /* now launch the real connection.  Since we are in non-blocking mode, this
      call will return -1 in MOST cases (on some systems, a connect() to a local
      address may immediately return successfully) */
-  ret = netcat_connect(sock, domain, addr, port);
+  ret = connect(sock, addr, addr_len);
   if ((ret < 0) && (errno != EINPROGRESS)) {
     ret = -5;
     goto err;
@@ -569,6 +935,39 @@ int netcat_socket_new_connect(nc_domain_t domain, nc_proto_t proto,
   return ret;
 }
 
+/* Creates a full outgoing async socket connection in the specified `domain'
+   and `type' to the specified `addr' and `port'.  The connection is
+   originated using the optionally specified `local_addr' and `local_port'.
+   If `local_addr' is NULL and `local_port' is 0 the bind(2) call is skipped.
+   Returns the same values of netcat_socket_new_connect_sa(). */
+
+int netcat_socket_new_connect(nc_domain_t domain, nc_proto_t proto,
+			      const nc_host_t *addr, const nc_port_t *port,
+			      const nc_host_t *local_addr, const nc_port_t *local_port,
+			      const nc_sockopts_t *opts)
+{
+  struct sockaddr *rem_addr, *my_addr = NULL;
+  unsigned int rem_addr_len, my_addr_len = 0;
+  int ret, saved_errno;
+  assert(addr);
+
+  debug_dv(("netcat_socket_new_connect(domain=%d, addr=%p, port=%hu, "
+	    "local_addr=%p, local_port=%hu)", domain, (void *)addr, port->num,
+	    (void *)local_addr, local_port->num));
+
+  prepare_sockaddr(domain, addr, port, &rem_addr, &rem_addr_len);
+  if (local_addr || local_port->num)
+    prepare_sockaddr(domain, local_addr, local_port, &my_addr, &my_addr_len);
+
+  ret = netcat_socket_new_connect_sa(domain, proto, rem_addr, rem_addr_len,
+				     my_addr, my_addr_len, opts);
+  saved_errno = errno;
+  free(rem_addr);
+  free(my_addr);
+  errno = saved_errno;
+  return ret;
+}
+
 /* Creates a listening TCP (stream) socket already bound and in listening
    state in the specified `domain', ready for accept(2) or select(2).  The
    `addr' parameter is optional and specifies the local interface at which
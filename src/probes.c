@@ -0,0 +1,272 @@
+/*
+ * probes.c -- payloads sent by the UDP scanner to well-known services
+ * Part of the GNU netcat project
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "netcat.h"
+
+/* Most UDP services silently drop the datagrams they can't parse, so an empty
+   probe would only tell that the port is open|filtered.  Sending a valid
+   request instead makes them answer at the first try. */
+
+typedef struct {
+  unsigned short port;		/* destination port */
+  const char *data;		/* payload */
+  size_t len;			/* payload length */
+} nc_probe_t;
+
+#define PROBE(__port, __data) { __port, __data, sizeof(__data) - 1 }
+
+/* Built-in payloads.  This table MUST be kept sorted by port, since it is
+   searched with a binary search. */
+static const nc_probe_t probes_builtin[] = {
+  /* DNS: standard query for the NS records of the root zone */
+  PROBE(53, "\x4e\x43\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00"
+	    "\x00\x00\x02\x00\x01"),
+  /* TFTP: read request (an error packet is a valid answer too) */
+  PROBE(69, "\x00\x01" "netcat.txt\x00" "octet\x00"),
+  /* Sun RPC: NULL procedure call to the portmapper, version 2 */
+  PROBE(111, "\x4e\x43\x00\x6f\x00\x00\x00\x00\x00\x00\x00\x02"
+	     "\x00\x01\x86\xa0\x00\x00\x00\x02\x00\x00\x00\x00"
+	     "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+	     "\x00\x00\x00\x00"),
+  /* NTP: version 3 client mode request */
+  PROBE(123, "\x1b\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+	     "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+	     "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+	     "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"),
+  /* NetBIOS name service: node status request for the wildcard name */
+  PROBE(137, "\x4e\x43\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00"
+	     "\x20" "CKAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" "\x00\x00\x21\x00\x01"),
+  /* SNMP: v1 get-request of sysDescr.0 with the "public" community */
+  PROBE(161, "\x30\x29\x02\x01\x00\x04\x06" "public"
+	     "\xa0\x1c\x02\x04\x4e\x43\x00\xa1\x02\x01\x00\x02\x01\x00"
+	     "\x30\x0e\x30\x0c\x06\x08\x2b\x06\x01\x02\x01\x01\x01\x00"
+	     "\x05\x00"),
+  /* SSDP: discovery of all the devices and services */
+  PROBE(1900, "M-SEARCH * HTTP/1.1\r\n"
+	      "HOST: 239.255.255.250:1900\r\n"
+	      "MAN: \"ssdp:discover\"\r\n"
+	      "MX: 1\r\n"
+	      "ST: ssdp:all\r\n\r\n"),
+  /* mDNS: DNS-SD services enumeration */
+  PROBE(5353, "\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00"
+	      "\x09_services\x07_dns-sd\x04_udp\x05local\x00\x00\x0c\x00\x01"),
+  /* memcached: "version" command with the UDP frame header */
+  PROBE(11211, "\x4e\x43\x00\x00\x00\x01\x00\x00" "version\r\n"),
+};
+
+#define PROBES_BUILTIN (sizeof(probes_builtin) / sizeof(probes_builtin[0]))
+
+/* Payloads loaded with netcat_probes_load(), sorted by port as well.  They
+   take precedence over the built-in ones. */
+static nc_probe_t *probes_custom = NULL;
+static size_t probes_custom_count = 0;
+static size_t probes_custom_size = 0;
+
+/* While a file is loaded, the position (plus one) of the custom payload of
+   each port, so that the large ranges are inserted in linear time */
+static unsigned short *probes_index = NULL;
+
+static int probes_compare(const void *a, const void *b)
+{
+  return (int)((const nc_probe_t *)a)->port - (int)((const nc_probe_t *)b)->port;
+}
+
+/* Adds (or replaces) the custom payload for the port `port' */
+
+static void probes_insert(unsigned short port, const char *data, size_t len)
+{
+  size_t i;
+
+  if (!probes_index) {
+    probes_index = calloc(65536, sizeof(*probes_index));
+    for (i = 0; i < probes_custom_count; i++)
+      probes_index[probes_custom[i].port] = i + 1;
+  }
+
+  if (!(i = probes_index[port])) {
+    if (probes_custom_count == probes_custom_size) {
+      probes_custom_size = (probes_custom_size ? probes_custom_size * 2 : 64);
+      probes_custom = realloc(probes_custom,
+			      probes_custom_size * sizeof(*probes_custom));
+    }
+    i = probes_index[port] = ++probes_custom_count;
+  }
+  i--;
+  probes_custom[i].port = port;
+  probes_custom[i].data = data;
+  probes_custom[i].len = len;
+}
+
+/* Decodes the quoted string starting at `str' (which points to the opening
+   double quote), handling the usual C escape sequences.  The decoded data is
+   stored in `dst' which must be at least as long as `str'.
+   Returns the decoded length, or -1 if the string is malformed. */
+
+static int probes_unquote(char *dst, const char *str)
+{
+  const char *p = str + 1;
+  int len = 0;
+
+  while (*p && (*p != '"')) {
+    if (*p != '\\') {
+      dst[len++] = *p++;
+      continue;
+    }
+
+    switch (*++p) {
+    case 'n': dst[len++] = '\n'; p++; break;
+    case 'r': dst[len++] = '\r'; p++; break;
+    case 't': dst[len++] = '\t'; p++; break;
+    case 'x':			/* one or two hex digits */
+      {
+	char hex[3] = { 0, 0, 0 };
+
+	if (!isxdigit((int)*++p))
+	  return -1;
+	hex[0] = *p++;
+	if (isxdigit((int)*p))
+	  hex[1] = *p++;
+	dst[len++] = (char)strtol(hex, NULL, 16);
+      }
+      break;
+    case '0': case '1': case '2': case '3':
+    case '4': case '5': case '6': case '7':
+      {
+	int n, val = 0;
+
+	for (n = 0; (n < 3) && (*p >= '0') && (*p <= '7'); n++)
+	  val = val * 8 + (*p++ - '0');
+	dst[len++] = (char)val;
+      }
+      break;
+    case 0:
+      return -1;
+    default:			/* \\, \" and anything else */
+      dst[len++] = *p++;
+      break;
+    }
+  }
+
+  /* the string must be properly terminated and followed by nothing else */
+  if (*p++ != '"')
+    return -1;
+  while (isspace((int)*p))
+    p++;
+  return (*p && (*p != '#') ? -1 : len);
+}
+
+/* Loads the custom payloads from the file `filename'.  Each line contains a
+   list of ports and ports ranges separated by commas, followed by the
+   payload as a double-quoted string with C-style escapes, for example:
+     53,5353 "\x00\x00\x01\x00..."
+   Blank lines and comments starting with `#' are ignored.
+   Returns TRUE on success, FALSE if the file can't be read or is malformed
+   (an error message is printed in this case). */
+
+bool netcat_probes_load(const char *filename)
+{
+  FILE *fp;
+  char line[4096];
+  int lineno = 0;
+
+  if (!(fp = fopen(filename, "r"))) {
+    ncprint(NCPRINT_ERROR, _("Failed to open probes file: %s (%s)"), filename,
+	    strerror(errno));
+    return FALSE;
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    char *ports, *quote, *token, *data;
+    int len;
+
+    lineno++;
+    for (ports = line; isspace((int)*ports); ports++);
+    if (!*ports || (*ports == '#'))
+      continue;
+
+    if (!(quote = strchr(ports, '"')))
+      goto bad_line;
+    data = malloc(strlen(quote) + 1);
+    if ((len = probes_unquote(data, quote)) < 0) {
+      free(data);
+      goto bad_line;
+    }
+    *quote = 0;
+
+    while ((token = strsep(&ports, ", \t"))) {
+      long lo, hi;
+      char *endptr;
+
+      if (!*token)
+	continue;
+      lo = hi = strtol(token, &endptr, 10);
+      if (*endptr == '-')
+	hi = strtol(endptr + 1, &endptr, 10);
+      if (*endptr || (lo < 1) || (hi > 65535) || (hi < lo)) {
+	free(data);
+	goto bad_line;
+      }
+      for (; lo <= hi; lo++)
+	probes_insert((unsigned short)lo, data, len);
+    }
+    continue;
+
+ bad_line:
+    ncprint(NCPRINT_ERROR, _("Invalid probe at %s:%d"), filename, lineno);
+    fclose(fp);
+    free(probes_index);
+    probes_index = NULL;
+    return FALSE;
+  }
+
+  fclose(fp);
+  /* the positions change with the sorting */
+  free(probes_index);
+  probes_index = NULL;
+  qsort(probes_custom, probes_custom_count, sizeof(*probes_custom),
+	probes_compare);
+  debug_v(("netcat_probes_load(): %d custom probes loaded",
+	  (int)probes_custom_count));
+  return TRUE;
+}
+
+/* Finds the payload to be sent to the UDP port `port'.  The length of the
+   payload is stored in `len'.  Returns NULL if there is no payload for this
+   port, in which case an empty datagram should be sent. */
+
+const char *netcat_probes_get(unsigned short port, size_t *len)
+{
+  nc_probe_t key;
+  const nc_probe_t *found = NULL;
+
+  key.port = port;
+  if (probes_custom)
+    found = bsearch(&key, probes_custom, probes_custom_count,
+		    sizeof(*probes_custom), probes_compare);
+  if (!found)
+    found = bsearch(&key, probes_builtin, PROBES_BUILTIN,
+		    sizeof(*probes_builtin), probes_compare);
+
+  *len = (found ? found->len : 0);
+  return (found ? found->data : NULL);
+}
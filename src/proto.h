@@ -22,6 +22,37 @@
  *                                                                         *
  ***************************************************************************/
 
+/* cache.c */
+bool netcat_cache_open(const char *filename);
+void netcat_cache_close(void);
+int netcat_cache_get(nc_cache_t type, const char *key, void *value,
+		     size_t size);
+int netcat_cache_get_addrs(const char *name, struct in_addr *iaddrs);
+void netcat_cache_put(nc_cache_t type, const char *key, const void *value,
+		      size_t len, unsigned long ttl);
+
+/* dns.c */
+bool netcat_dns_init(const char *server);
+bool netcat_dns_enabled(void);
+int netcat_dns_fd(void);
+unsigned long long netcat_dns_timeout(void);
+int netcat_dns_query(const char *name, nc_dns_cb_t cb, void *arg);
+int netcat_dns_query_ptr(struct in_addr addr, nc_dns_cb_t cb, void *arg);
+void netcat_dns_prefetch(const char *name);
+void netcat_dns_process(void);
+void netcat_dns_wait(void);
+bool netcat_dns_resolve(nc_host_t *dst, const char *name);
+bool netcat_dns_resolve_ptr(char *name, struct in_addr addr);
+
+/* framing.c */
+void netcat_framer_init(nc_framer_t *fr);
+void netcat_framer_free(nc_framer_t *fr);
+ssize_t netcat_framer_fill(nc_framer_t *fr, int fd);
+bool netcat_framer_next(nc_framer_t *fr, unsigned char **data, size_t *len);
+int netcat_framing_iov(struct iovec *iov, unsigned char *hdr, void *data,
+		       size_t len);
+int netcat_framing_write(int fd, const void *data, size_t len);
+
 /* portsrange.c */
 void netcat_ports_insert(nc_ports_t *portsrange, unsigned short first, unsigned short last);
 bool netcat_ports_isset(nc_ports_t portsrange, unsigned short port);
@@ -29,11 +60,22 @@ int netcat_ports_count(nc_ports_t portsrange);
 unsigned short netcat_ports_next(nc_ports_t portsrange, unsigned short port);
 unsigned short netcat_ports_rand(nc_ports_t portsrange);
 
+/* targets.c */
+bool netcat_targets_isrange(const char *spec);
+bool netcat_targets_parse(nc_targets_t *targets, const char *spec);
+unsigned long netcat_targets_count(nc_targets_t targets);
+void netcat_targets_insert(nc_targets_t *targets, const nc_host_t *host);
+void netcat_targets_rewind(nc_targets_t targets, nc_targets_pos_t *pos);
+bool netcat_targets_next(nc_targets_pos_t *pos, struct in_addr *addr,
+			 const char **name);
+void netcat_targets_free(nc_targets_t targets);
+
 /* misc.c */
 char *netcat_ascii_convert(const char *source, int source_len,
 			   nc_convert_t conversion, int *target_len);
 int netcat_fhexdump(FILE *stream, char c, const void *data, size_t datalen);
 int netcat_snprintnum(char *str, size_t size, unsigned long number);
+unsigned long long netcat_time_usec(void);
 void netcat_printstats(bool force);
 char *netcat_string_split(char **buf);
 void netcat_commandline_read(int *argc, char ***argv);
@@ -49,22 +91,33 @@ void update_timeval(struct timeval *target);
 /* netcat.c */
 extern nc_mode_t netcat_mode;
 extern bool opt_eofclose, opt_numeric, opt_random, opt_hexdump,
-	opt_telnet, opt_zero;
-extern int opt_interval, opt_wait;
+	opt_telnet, opt_zero, opt_reset, opt_syn;
+extern int opt_interval, opt_wait, opt_parallel, opt_rate, opt_burst,
+	opt_retries, opt_banner, opt_sessions;
+extern long opt_since;
+extern char *opt_statefile;
+extern char *opt_exec;
+extern nc_format_t opt_format;
+extern nc_framing_t opt_framing;
 extern char *opt_outputfile;
 extern nc_proto_t opt_proto;
+extern nc_domain_t opt_domain;
+extern bool opt_anyfamily;
 extern FILE *output_fp;
 extern bool use_stdin, signal_handler, got_sigterm, got_sigint, got_sigusr1,
 	commandline_need_newline;
+void ncexec(nc_sock_t *ncsock);
 
 /* netcore.c */
-extern unsigned long bytes_sent, bytes_recv;
+extern unsigned long bytes_sent, bytes_recv, dgrams_recv, dgrams_dropped,
+	dgrams_toobig;
 int core_connect(nc_sock_t *ncsock);
 int core_listen(nc_sock_t *ncsock);
 int core_readwrite(nc_sock_t *nc_main, nc_sock_t *nc_slave);
 
 /* network.c */
 bool netcat_resolvehost(nc_host_t *dst, const char *name);
+bool netcat_resolvehost6(nc_host_t *dst, const char *name);
 
 bool netcat_getport(nc_port_t *dst, const char *port_name,
 		    unsigned short port_num);
@@ -81,24 +134,64 @@ int netcat_socket_new(nc_domain_t domain, nc_proto_t proto,
 int netcat_bind(int sock, nc_domain_t domain, const nc_host_t *addr, const nc_port_t *port);
 int netcat_connect(int sock, nc_domain_t domain, const nc_host_t *addr, const nc_port_t *port);
 
+void netcat_close_reset(int sock);
+#ifdef USE_PMTU
+int netcat_socket_mtu(int sock);
+#endif
+
 int netcat_socket_new_connect(nc_domain_t domain, nc_proto_t proto,
 			      const nc_host_t *addr, const nc_port_t *port,
 			      const nc_host_t *local_addr, const nc_port_t *local_port,
 			      const nc_sockopts_t *opts);
+int netcat_socket_new_connect_sa(nc_domain_t domain, nc_proto_t proto,
+				 const struct sockaddr *addr,
+				 unsigned int addr_len,
+				 const struct sockaddr *local,
+				 unsigned int local_len,
+				 const nc_sockopts_t *opts);
 
 int netcat_socket_new_listen(nc_domain_t domain, const nc_host_t *addr,
 			     const nc_port_t *port, const nc_sockopts_t *opts);
 
 int netcat_socket_accept(int fd, int timeout);
 
+/* probes.c */
+bool netcat_probes_load(const char *filename);
+const char *netcat_probes_get(unsigned short port, size_t *len);
+
+/* server.c */
+int core_udp_server(nc_sock_t *ncsock, int idle);
+
+/* state.c */
+bool netcat_state_load(const char *filename);
+bool netcat_state_save(const char *filename);
+nc_scanstate_t netcat_state_get(struct in_addr addr, unsigned short port,
+				nc_proto_t proto, unsigned long *stamp);
+void netcat_state_set(struct in_addr addr, unsigned short port,
+		      nc_proto_t proto, nc_scanstate_t state, unsigned long rtt);
+
+/* scan.c */
+int core_scan(const nc_sock_t *ncsock, nc_targets_t targets, nc_ports_t ports,
+	      int list_fd, int parallel);
+
+/* workers.c */
+int netcat_workers_start(int count);
+
 /* telnet.c */
 void netcat_telnet_parse(nc_sock_t *ncsock);
 
 /* udphelper.c */
-#ifdef USE_PKTINFO
+#ifdef USE_DSTADDR
+int udphelper_dstaddr(int sock, bool enable);
 int udphelper_ancillary_read(struct msghdr *my_hdr,
 			     struct sockaddr_in *get_addr);
+#ifdef USE_SENDSRC
+void udphelper_ancillary_src(struct msghdr *my_hdr, struct in_addr src);
+#endif
 #else
 int udphelper_sockets_open(int **sockbuf, in_port_t nport);
 #endif
 void udphelper_sockets_close(int *sockbuf);
+#ifdef USE_RXQ_OVFL
+void udphelper_ancillary_drops(struct msghdr *my_hdr, unsigned int *last);
+#endif
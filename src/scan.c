@@ -0,0 +1,1865 @@
+/*
+ * scan.c -- concurrent scanning engine for multiple hosts and ports
+ * Part of the GNU netcat project
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "netcat.h"
+#include <fcntl.h>		/* fcntl() */
+#include <time.h>		/* time(2) for the incremental scans */
+#ifdef USE_RECVERR
+# include <linux/errqueue.h>	/* struct sock_extended_err */
+#endif
+
+/* Error code used in the place of an errno value for targets whose hostname
+   couldn't be resolved. */
+#define SCAN_ERR_UNRESOLVED -1
+
+/* Error code used for malformed lines in the targets list. */
+#define SCAN_ERR_INVALID -2
+
+/* Error code used for UDP ports that answered with an ICMP "communication
+   administratively prohibited" error. */
+#define SCAN_ERR_FILTERED -3
+
+/* Error code used for UDP probes that never got any answer, which means that
+   either the port is open or the probes are silently dropped. */
+#define SCAN_ERR_NOREPLY -4
+
+/* Error code used for the targets list entries whose hostname is being
+   looked up by the built-in resolver. */
+#define SCAN_ERR_RESOLVING -5
+
+/* The target of a probe.  There is one in each slot and in each read ahead
+   entry, so it only holds what the engines need: everything else (the
+   protocol, the timeout, the socket options...) is the same for all the
+   probes and stays in the template connection record `scan_sock'.  The
+   strings needed for the messages are built only when they are printed. */
+
+typedef struct {
+  struct sockaddr_in addr;	/* address and port (network byte order) */
+  const char *name;		/* hostname as it was written, or NULL */
+  const char *port_text;	/* port as it was written, if invalid */
+} scan_target_t;
+
+/* A slot of the concurrency pool.  Each slot holds at most one outstanding
+   probe, and a free slot has its socket descriptor set to -1.  UDP probes
+   all share the same socket, so in that case the descriptor only marks the
+   slot as busy. */
+
+typedef struct {
+  int fd;			/* socket of the probe, or -1 */
+  scan_target_t target;		/* target of the probe */
+  struct in_addr source;	/* local address (see scan_pick_source()) */
+  unsigned long long deadline;	/* absolute timeout (usec), 0 means none */
+  int tries;			/* probes sent so far */
+  unsigned long long started;	/* time the (last) probe was sent (usec) */
+  unsigned long long answered;	/* time the connection completed, or 0 */
+  bool pending;			/* target fetched, but not started yet */
+  bool reading;			/* connected, waiting for the banner */
+  char *banner;			/* banner buffer (opt_banner bytes), or NULL */
+  int banner_len;		/* bytes of banner received so far */
+} scan_slot_t;
+
+/* With the built-in resolver, the lines of a targets list are read ahead of
+   the probes, so that the hostnames are looked up concurrently.  The entries
+   are kept in a circular queue in the order of the list, and each of them is
+   handed to the engine once its lookup is complete. */
+
+typedef struct {
+  scan_target_t target;
+  int err;			/* 0 or one of the SCAN_ERR_* codes */
+} scan_ahead_t;
+
+/* The scheduler feeds the engine with targets from one of two sources.  With
+   a targets set, the hosts are walked in the inner loop and the ports in the
+   outer loop, so consecutive probes always hit different hosts.  Nothing is
+   ever expanded: the position is just a targets iterator plus the current
+   port.  With a targets list, "host:port" lines are read from a stream only
+   when a slot is free, so the list can be of any size. */
+
+typedef struct {
+  nc_targets_t targets;		/* hosts to be scanned */
+  nc_targets_pos_t pos;		/* next host for the current port */
+  nc_ports_t ports;		/* ports to be scanned on each host */
+  unsigned short port;		/* current port */
+  int left_ports;		/* ports still to be started (outer loop) */
+  int list_fd;			/* targets list stream, or -1 */
+  int list_flags;		/* original file status flags of list_fd */
+  bool list_eof;		/* the whole list has been read */
+  char list_buf[4096];		/* partial lines read from the stream */
+  int list_len;			/* bytes of data in list_buf */
+  bool list_skip;		/* dropping the rest of a line too long */
+  scan_ahead_t *ahead;		/* lines read ahead, or NULL */
+  int ahead_size;		/* capacity of the read ahead queue */
+  int ahead_first;		/* index of the oldest entry */
+  int ahead_count;		/* entries in the queue */
+  unsigned long skipped;	/* targets skipped by the incremental scan */
+} scan_sched_t;
+
+/* A stateless engine sends all its probes from a single socket, and matches
+   the answers to the probes by address and port, so that the number of
+   probes in flight is not limited by the number of descriptors. */
+
+typedef struct scan_engine_st {
+  int sock;			/* socket all the probes are sent from */
+  int noreply;			/* outcome of the unanswered probes */
+  int (*send)(struct scan_engine_st *engine, scan_slot_t *slot);
+  int (*collect)(struct scan_engine_st *engine, scan_slot_t *slots,
+		 int parallel, int *active, bool multi, bool results);
+  struct in_addr source;	/* SYN: source address, 0 for the default */
+  in_port_t source_port;	/* SYN: source port (network byte order) */
+  int route_fd;			/* SYN: UDP socket for the route lookups */
+  int guard_fd;			/* SYN: TCP socket reserving the port */
+  unsigned long secret;		/* SYN: key of the sequence numbers */
+} scan_engine_t;
+
+/* The probes rate is limited with a token bucket: it is refilled with
+   `opt_rate' tokens per second up to `opt_burst' tokens, and each probe sent
+   takes one token.  The level is kept in millionths of a token, so that the
+   refill is exact at the microsecond resolution of the timers. */
+
+#define SCAN_TOKEN 1000000ULL
+
+typedef struct {
+  unsigned long long level;	/* available tokens (in millionths) */
+  unsigned long long size;	/* capacity of the bucket (in millionths) */
+  unsigned long long last;	/* time of the last refill (usec) */
+} scan_bucket_t;
+
+/* Upper bounds (usec) of the buckets of the latency histogram, the last
+   bucket holds everything slower. */
+
+static const unsigned long scan_lat_bounds[] = {
+  100, 1000, 10000, 100000, 1000000
+};
+
+static const char *scan_lat_names[] = {
+  "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"
+};
+
+#define SCAN_LAT_BUCKETS (sizeof(scan_lat_names) / sizeof(scan_lat_names[0]))
+
+/* Statistics of a scan, printed as a summary at the end */
+
+typedef struct {
+  unsigned long states[NETCAT_STATE_ERROR + 1]; /* probes by final state */
+  unsigned long unresolved;	/* targets whose name couldn't be resolved */
+  unsigned long invalid;	/* malformed lines of the targets list */
+  unsigned long lat_hist[SCAN_LAT_BUCKETS]; /* open ports by latency */
+  unsigned long lat_count;	/* open ports with a latency */
+  unsigned long long lat_min, lat_max, lat_sum;	/* open ports latency */
+} scan_stats_t;
+
+static scan_stats_t scan_stats;
+
+/* Connection record used as a template for all the probes of the scan */
+static const nc_sock_t *scan_sock = NULL;
+
+/* The strings read from a targets list (the hostnames, and the text of the
+   invalid lines) are interned in a hash table, so that the probes of the
+   same host share one copy of its name.  Each string counts the targets
+   holding it and is freed as soon as the last of them is finished, so the
+   table only holds the hosts of the probes in flight, and it doubles its
+   buckets when it gets crowded.  Numeric addresses are not kept at all,
+   since they are shown from the address itself. */
+
+#define SCAN_STRINGS_MIN 64
+
+typedef struct scan_string_st {
+  struct scan_string_st *next;
+  unsigned int hash;		/* full hash of the string */
+  unsigned int refs;		/* targets holding the string */
+  char str[1];
+} scan_string_t;
+
+static scan_string_t **scan_strings = NULL;
+static unsigned int scan_strings_size = 0;	/* number of buckets */
+static unsigned int scan_strings_count = 0;	/* number of strings */
+
+static unsigned int scan_hash(const char *str)
+{
+  unsigned int hash = 5381;
+
+  for (; *str; str++)
+    hash = hash * 33 + (unsigned char)*str;
+  return hash;
+}
+
+/* Doubles the buckets of the strings table, creating it on the first call */
+
+static void scan_strings_grow(void)
+{
+  unsigned int i, size;
+  scan_string_t **table;
+
+  size = (scan_strings_size ? scan_strings_size * 2 : SCAN_STRINGS_MIN);
+  table = calloc(size, sizeof(*table));
+  for (i = 0; i < scan_strings_size; i++)
+    while (scan_strings[i]) {
+      scan_string_t *cur = scan_strings[i];
+
+      scan_strings[i] = cur->next;
+      cur->next = table[cur->hash % size];
+      table[cur->hash % size] = cur;
+    }
+  free(scan_strings);
+  scan_strings = table;
+  scan_strings_size = size;
+}
+
+/* Returns the interned copy of `str', taking a reference to it that must be
+   dropped with scan_release(). */
+
+static const char *scan_intern(const char *str)
+{
+  unsigned int hash = scan_hash(str);
+  scan_string_t *cur;
+
+  if (scan_strings_count >= scan_strings_size)
+    scan_strings_grow();
+  for (cur = scan_strings[hash % scan_strings_size]; cur; cur = cur->next)
+    if ((cur->hash == hash) && !strcmp(cur->str, str)) {
+      cur->refs++;
+      return cur->str;
+    }
+
+  cur = malloc(sizeof(*cur) + strlen(str));
+  strcpy(cur->str, str);
+  cur->hash = hash;
+  cur->refs = 1;
+  cur->next = scan_strings[hash % scan_strings_size];
+  scan_strings[hash % scan_strings_size] = cur;
+  scan_strings_count++;
+  return cur->str;
+}
+
+/* Drops a reference to the interned string `str', which is freed with the
+   last one.  The strings that don't come from the table (such as the names
+   given on the command line) and NULL are ignored. */
+
+static void scan_release(const char *str)
+{
+  scan_string_t **link, *cur;
+
+  if (!str || !scan_strings)
+    return;
+  for (link = &scan_strings[scan_hash(str) % scan_strings_size]; (cur = *link);
+       link = &cur->next)
+    if (cur->str == str) {
+      if (--cur->refs == 0) {
+	*link = cur->next;
+	free(cur);
+	scan_strings_count--;
+      }
+      return;
+    }
+}
+
+/* Frees the whole strings table, including the strings still referenced by
+   the targets of an interrupted scan */
+
+static void scan_intern_free(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < scan_strings_size; i++)
+    while (scan_strings[i]) {
+      scan_string_t *next = scan_strings[i]->next;
+
+      free(scan_strings[i]);
+      scan_strings[i] = next;
+    }
+  free(scan_strings);
+  scan_strings = NULL;
+  scan_strings_size = 0;
+  scan_strings_count = 0;
+}
+
+/* Initializes the token bucket `bucket', which starts full */
+
+static void scan_bucket_init(scan_bucket_t *bucket)
+{
+  bucket->size = (opt_burst > 0 ? opt_burst : 1) * SCAN_TOKEN;
+  bucket->level = bucket->size;
+  bucket->last = netcat_time_usec();
+}
+
+/* Refills the bucket for the time elapsed since the last refill.  Returns
+   TRUE if a probe can be sent at the time `now', which is always the case
+   when the rate is not limited. */
+
+static bool scan_bucket_ready(scan_bucket_t *bucket, unsigned long long now)
+{
+  if (opt_rate <= 0)
+    return TRUE;
+
+  if (now > bucket->last) {
+    bucket->level += (now - bucket->last) * opt_rate;
+    if (bucket->level > bucket->size)
+      bucket->level = bucket->size;
+    bucket->last = now;
+  }
+  return (bucket->level >= SCAN_TOKEN);
+}
+
+/* Takes the token of a probe that was just sent */
+
+static void scan_bucket_take(scan_bucket_t *bucket)
+{
+  if ((opt_rate > 0) && (bucket->level >= SCAN_TOKEN))
+    bucket->level -= SCAN_TOKEN;
+}
+
+/* Returns the time when the next token will be available, which is `now'
+   if there is one already. */
+
+static unsigned long long scan_bucket_when(scan_bucket_t *bucket,
+					   unsigned long long now)
+{
+  if (scan_bucket_ready(bucket, now))
+    return now;
+  return now + (SCAN_TOKEN - bucket->level + opt_rate - 1) / opt_rate;
+}
+
+/* Fills the target `target' with the host `addr' and the port `port'.  The
+   `name' is optional and is displayed in place of the address, it must stay
+   valid until the target is finished (see scan_release()). */
+
+static void scan_set_target(scan_target_t *target, struct in_addr addr,
+			    const char *name, unsigned short port)
+{
+  memset(&target->addr, 0, sizeof(target->addr));
+  target->addr.sin_family = AF_INET;
+  target->addr.sin_addr = addr;
+  target->addr.sin_port = htons(port);
+  target->name = name;
+  target->port_text = NULL;
+}
+
+/* Parses the targets list line `line' in the form "host:port" (IPv6-style
+   "[host]:port" is accepted too) and fills the target `target'.
+   Returns 0 on success or one of the SCAN_ERR_* codes.  With the built-in
+   resolver hostnames are not looked up here (unless they are cached), and
+   SCAN_ERR_RESOLVING is returned for them instead. */
+
+static int scan_parse_line(scan_target_t *target, char *line)
+{
+  char *host = line, *port;
+  nc_port_t port_rec;
+  nc_host_t host_rec;
+  struct in_addr addr;
+  bool numeric;
+
+  memset(&addr, 0, sizeof(addr));
+  scan_set_target(target, addr, NULL, 0);
+
+  if ((host[0] == '[') && (port = strchr(host, ']'))) {
+    *port++ = 0;
+    host++;
+    if (*port != ':')
+      port = NULL;
+  }
+  else
+    port = strrchr(host, ':');
+
+  /* keep the original text, it's needed for the result line anyway */
+  if (!port || !port[1] || !host[0]) {
+    target->name = scan_intern(line);
+    return SCAN_ERR_INVALID;
+  }
+  *port++ = 0;
+
+  /* numeric addresses are taken as they are, without any reverse lookup,
+     and they need no name */
+  numeric = (netcat_inet_pton(AF_INET, host, &target->addr.sin_addr) > 0);
+  if (!numeric)
+    target->name = scan_intern(host);
+  if (!netcat_getport(&port_rec, port, 0)) {
+    target->port_text = scan_intern(port);
+    return SCAN_ERR_INVALID;
+  }
+  target->addr.sin_port = port_rec.netnum;
+  if (numeric)
+    return 0;
+
+  if (netcat_dns_enabled() && !opt_numeric &&
+      !netcat_cache_get_addrs(host, NULL))
+    return SCAN_ERR_RESOLVING;
+
+  if (!netcat_resolvehost(&host_rec, host))
+    return SCAN_ERR_UNRESOLVED;
+  target->addr.sin_addr = host_rec.host.iaddrs[0];
+  return 0;
+}
+
+/* Extracts the next complete line from the targets list, reading some more
+   data from the stream if needed.  Blank lines and comments are skipped.
+   Returns 1 if a line was stored in `line', 0 if no complete line is
+   available yet, or -1 at the end of the stream. */
+
+static int scan_read_line(scan_sched_t *sched, char *line, size_t size)
+{
+  while (TRUE) {
+    char *eol = memchr(sched->list_buf, '\n', sched->list_len);
+    int len;
+
+    /* the rest of a line longer than the buffer is dropped as well, up to
+       its newline, or it would be taken for a line of its own */
+    if (sched->list_skip) {
+      len = (eol ? eol + 1 - sched->list_buf : sched->list_len);
+      sched->list_len -= len;
+      memmove(sched->list_buf, sched->list_buf + len, sched->list_len);
+      sched->list_skip = !eol;
+      eol = NULL;
+      if (!sched->list_skip)
+	continue;
+    }
+
+    /* the last line of the stream may lack the final newline */
+    if (!eol && sched->list_eof && (sched->list_len > 0))
+      eol = sched->list_buf + sched->list_len;
+
+    if (eol) {
+      char *p, *q;
+
+      len = eol - sched->list_buf;
+      if ((size_t)len >= size)
+	len = size - 1;
+      memcpy(line, sched->list_buf, len);
+      line[len] = 0;
+
+      len = eol - sched->list_buf + (eol < sched->list_buf + sched->list_len);
+      sched->list_len -= len;
+      memmove(sched->list_buf, sched->list_buf + len, sched->list_len);
+
+      /* trim comments and spaces */
+      if ((p = strchr(line, '#')))
+	*p = 0;
+      for (p = line; isspace((int)*p); p++);
+      for (q = p + strlen(p); (q > p) && isspace((int)q[-1]); q--);
+      *q = 0;
+      if (!*p)
+	continue;
+      memmove(line, p, q - p + 1);
+      return 1;
+    }
+
+    if (sched->list_eof)
+      return -1;
+
+    /* a line longer than the buffer is garbage anyway, discard it */
+    if (sched->list_len == sizeof(sched->list_buf)) {
+      sched->list_len = 0;
+      sched->list_skip = TRUE;
+    }
+
+    len = read(sched->list_fd, sched->list_buf + sched->list_len,
+	       sizeof(sched->list_buf) - sched->list_len);
+    if (len < 0) {
+      if ((errno == EAGAIN) || (errno == EINTR))
+	return 0;
+      ncprint(NCPRINT_ERROR, _("Failed to read the targets list: %s"),
+	      strerror(errno));
+      len = 0;
+    }
+    if (len == 0)
+      sched->list_eof = TRUE;
+    sched->list_len += len;
+  }
+}
+
+/* Completes the lookup of the read ahead entry `arg' */
+
+static void scan_resolved(void *arg, const struct in_addr *addrs, int naddrs,
+			  const char *name)
+{
+  scan_ahead_t *ahead = arg;
+
+  (void)name;
+  if (naddrs == 0) {
+    ahead->err = SCAN_ERR_UNRESOLVED;
+    return;
+  }
+  ahead->target.addr.sin_addr = addrs[0];
+  ahead->err = 0;
+}
+
+/* Reads as many lines of the targets list as the read ahead queue can hold,
+   starting the lookups of their hostnames, and then fetches the oldest
+   entry like scan_fetch() does.  Returns 0 if the oldest entry is still
+   being resolved. */
+
+static int scan_fetch_ahead(scan_sched_t *sched, scan_target_t *target,
+			    int *err)
+{
+  char line[MAXHOSTNAMELEN + NETCAT_MAXPORTNAMELEN + 4];
+  scan_ahead_t *ahead;
+  int ret = 0;
+
+  while (sched->ahead_count < sched->ahead_size) {
+    ahead = &sched->ahead[(sched->ahead_first + sched->ahead_count) %
+			  sched->ahead_size];
+    if ((ret = scan_read_line(sched, line, sizeof(line))) <= 0)
+      break;
+
+    ahead->err = scan_parse_line(&ahead->target, line);
+    sched->ahead_count++;
+    if ((ahead->err == SCAN_ERR_RESOLVING) &&
+	(netcat_dns_query(ahead->target.name, scan_resolved, ahead) < 0))
+      ahead->err = SCAN_ERR_UNRESOLVED;
+  }
+
+  if (sched->ahead_count == 0)
+    return ret;
+  ahead = &sched->ahead[sched->ahead_first];
+  if (ahead->err == SCAN_ERR_RESOLVING)
+    return 0;
+
+  memcpy(target, &ahead->target, sizeof(*target));
+  *err = ahead->err;
+  sched->ahead_first = (sched->ahead_first + 1) % sched->ahead_size;
+  sched->ahead_count--;
+  return 1;
+}
+
+/* Fetches the next target from the scheduler and stores it in `target'.
+   Returns 1 if a target was fetched, 0 if the targets list has no complete
+   line available yet, or -1 when all the probes have been started.  `err'
+   is set to 0 or to one of the SCAN_ERR_* codes if the target is not
+   valid. */
+
+static int scan_fetch(scan_sched_t *sched, scan_target_t *target, int *err)
+{
+  struct in_addr addr;
+  const char *name;
+
+  *err = 0;
+  if (sched->ahead)
+    return scan_fetch_ahead(sched, target, err);
+
+  if (sched->list_fd >= 0) {
+    char line[MAXHOSTNAMELEN + NETCAT_MAXPORTNAMELEN + 4];
+    int ret = scan_read_line(sched, line, sizeof(line));
+
+    if (ret > 0)
+      *err = scan_parse_line(target, line);
+    return ret;
+  }
+
+  while (!sched->port || !netcat_targets_next(&sched->pos, &addr, &name)) {
+    if (sched->left_ports == 0)
+      return -1;
+    sched->left_ports--;
+
+    if (opt_random)
+      sched->port = netcat_ports_rand(sched->ports);
+    else
+      sched->port = netcat_ports_next(sched->ports, sched->port);
+    netcat_targets_rewind(sched->targets, &sched->pos);
+  }
+
+  scan_set_target(target, addr, name, sched->port);
+  return 1;
+}
+
+/* Returns TRUE if the target `target' can be skipped by an incremental
+   scan, i.e. if it was found not open less than `opt_since' seconds ago.
+   Open ports are always checked again, since they are the ones that matter
+   the most. */
+
+static bool scan_fresh(const scan_target_t *target)
+{
+  unsigned long stamp;
+  nc_scanstate_t state;
+
+  if (opt_since < 0)
+    return FALSE;
+
+  state = netcat_state_get(target->addr.sin_addr, ntohs(target->addr.sin_port),
+			   scan_sock->proto, &stamp);
+  if ((state == NETCAT_STATE_UNKNOWN) || (state == NETCAT_STATE_OPEN) ||
+      (state == NETCAT_STATE_OPENFILTERED))
+    return FALSE;
+  return ((unsigned long)time(NULL) - stamp < (unsigned long)opt_since);
+}
+
+/* Same as scan_fetch(), but the targets whose state is still fresh are
+   skipped. */
+
+static int scan_next(scan_sched_t *sched, scan_target_t *target, int *err)
+{
+  int ret;
+
+  while (((ret = scan_fetch(sched, target, err)) > 0) && !*err &&
+	 scan_fresh(target)) {
+    scan_release(target->name);
+    sched->skipped++;
+  }
+  return ret;
+}
+
+/* Adds to `ins' the descriptors to be watched while the scheduler has no
+   target ready: the targets list, unless it can't be read any further, and
+   the socket of the built-in resolver.  The time when the resolver must be
+   called again is merged into `deadline'.  Returns the highest descriptor
+   plus one. */
+
+static int scan_wait_sched(scan_sched_t *sched, fd_set *ins,
+			   unsigned long long *deadline)
+{
+  int fd, fd_max = 0;
+
+  if (!sched->list_eof &&
+      (!sched->ahead || (sched->ahead_count < sched->ahead_size))) {
+    FD_SET(sched->list_fd, ins);
+    fd_max = sched->list_fd + 1;
+  }
+
+  if ((fd = netcat_dns_fd()) >= 0) {
+    unsigned long long when = netcat_dns_timeout();
+
+    FD_SET(fd, ins);
+    if (fd >= fd_max)
+      fd_max = fd + 1;
+    if (!*deadline || (when < *deadline))
+      *deadline = when;
+  }
+  return fd_max;
+}
+
+/* Picks the source address of the probe in the slot `slot' among all the
+   local addresses, in round-robin order according to the sequence number
+   `seq'.  Each source address has its own range of ephemeral ports, so
+   rotating them multiplies the number of connections that can be open at the
+   same time. */
+
+static void scan_pick_source(scan_slot_t *slot, unsigned long seq)
+{
+  const nc_host4_t *local = &scan_sock->local.host;
+  int n;
+
+  for (n = 0; (n < MAXINETADDRS) && local->iaddrs[n].s_addr; n++);
+  slot->source = local->iaddrs[(n < 2 ? 0 : seq % n)];
+}
+
+/* Starts a new probe for the target already stored in the slot `slot'.
+   Returns the new socket descriptor or a negative value if the probe couldn't
+   even be started (errno is set). */
+
+static int scan_start(scan_slot_t *slot)
+{
+  struct sockaddr_in local;
+
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr = slot->source;
+  local.sin_port = scan_sock->local_port.netnum;
+
+  slot->fd = netcat_socket_new_connect_sa(scan_sock->domain, scan_sock->proto,
+	(const struct sockaddr *)&slot->target.addr, sizeof(slot->target.addr),
+	(slot->source.s_addr || local.sin_port ?
+	 (const struct sockaddr *)&local : NULL), sizeof(local),
+	&scan_sock->opts);
+
+  slot->started = netcat_time_usec();
+  slot->tries = 1;
+  if (slot->fd >= 0)
+    slot->deadline = (scan_sock->timeout > 0 ?
+		      slot->started + scan_sock->timeout * 1000000ULL : 0);
+  return slot->fd;
+}
+
+/* State keywords used in the result lines, indexed by nc_scanstate_t */
+
+static const char *scan_state_names[] = {
+  "unknown", "open", "closed", "timeout", "unreachable", "filtered",
+  "open|filtered", "error"
+};
+
+/* Closes the socket of a completed TCP probe.  With `opt_reset' the
+   connection is reset, so that it doesn't linger in the TIME_WAIT state and
+   its local port can be reused at once by the next probes. */
+
+static void scan_close(scan_slot_t *slot)
+{
+  if (opt_reset)
+    netcat_close_reset(slot->fd);
+  else {
+    shutdown(slot->fd, 2);
+    close(slot->fd);
+  }
+}
+
+/* Translates the outcome of a probe into a port state */
+
+static nc_scanstate_t scan_state(int err)
+{
+  switch (err) {
+  case 0:
+    return NETCAT_STATE_OPEN;
+  case ECONNREFUSED:
+    return NETCAT_STATE_CLOSED;
+  case ETIMEDOUT:
+    return NETCAT_STATE_TIMEOUT;
+  case EHOSTUNREACH:
+  case ENETUNREACH:
+    return NETCAT_STATE_UNREACHABLE;
+  case SCAN_ERR_FILTERED:
+    return NETCAT_STATE_FILTERED;
+  case SCAN_ERR_NOREPLY:
+    return NETCAT_STATE_OPENFILTERED;
+  default:
+    return NETCAT_STATE_ERROR;
+  }
+}
+
+/* Translates the outcome of a probe into the state keyword used in the
+   result lines. */
+
+static const char *scan_strstate(int err)
+{
+  if (err == SCAN_ERR_UNRESOLVED)
+    return "unresolved";
+  if (err == SCAN_ERR_INVALID)
+    return "invalid";
+  return scan_state_names[scan_state(err)];
+}
+
+/* Prints the `len' bytes of `data' on one line, escaping the line breaks
+   and any other non printable character.  In the CSV and JSON formats the
+   data is printed as a quoted string of that format. */
+
+static void scan_print_escaped(const char *data, int len)
+{
+  int i;
+
+  if (opt_format != NETCAT_FORMAT_TEXT)
+    putchar('"');
+
+  for (i = 0; i < len; i++) {
+    unsigned char c = data[i];
+
+    if (opt_format == NETCAT_FORMAT_JSON) {
+      if ((c == '"') || (c == '\\'))
+	printf("\\%c", c);
+      else if (c == '\n')
+	fputs("\\n", stdout);
+      else if (c == '\r')
+	fputs("\\r", stdout);
+      else if (isprint((int)c))
+	putchar(c);
+      else
+	printf("\\u%04x", c);
+      continue;
+    }
+
+    if (c == '\r')
+      fputs("\\r", stdout);
+    else if (c == '\n')
+      fputs("\\n", stdout);
+    else if (c == '\\')
+      fputs("\\\\", stdout);
+    else if ((c == '"') && (opt_format == NETCAT_FORMAT_CSV))
+      fputs("\"\"", stdout);
+    else if (isprint((int)c))
+      putchar(c);
+    else
+      printf("\\x%02x", c);
+  }
+
+  if (opt_format != NETCAT_FORMAT_TEXT)
+    putchar('"');
+}
+
+/* Returns the host of the target `target' as it must be shown in the result
+   lines: the name it was given with, or else its address. */
+
+static const char *scan_strhost(const scan_target_t *target)
+{
+  return (target->name ? target->name :
+	  netcat_inet_ntop(AF_INET, &target->addr.sin_addr));
+}
+
+/* Returns the port of the target `target' as it must be shown in the result
+   lines, using the static buffer `buf'. */
+
+static const char *scan_strport(const scan_target_t *target, char *buf,
+				size_t size)
+{
+  if (target->port_text)
+    return target->port_text;
+  if (!target->addr.sin_port)
+    return "";
+  snprintf(buf, size, "%hu", ntohs(target->addr.sin_port));
+  return buf;
+}
+
+/* Same as netcat_strid(), for the target `target'.  The full host and port
+   records are only built here, when a message is actually printed. */
+
+static const char *scan_strid(const scan_target_t *target)
+{
+  nc_host_t host;
+  nc_port_t port;
+
+  memset(&host, 0, sizeof(host));
+  host.host.iaddrs[0] = target->addr.sin_addr;
+  strncpy(host.host.addrs[0],
+	  netcat_inet_ntop(AF_INET, &target->addr.sin_addr),
+	  sizeof(host.host.addrs[0]) - 1);
+  if (target->name)
+    strncpy(host.host.name, target->name, sizeof(host.host.name) - 1);
+  netcat_getport(&port, NULL, ntohs(target->addr.sin_port));
+  return netcat_strid(scan_sock->domain, &host, &port);
+}
+
+/* Prints the result of the probe held by `slot' in the CSV or JSON format:
+   the target, the state, the latency (time from the last probe sent to the
+   outcome) and the number of probes sent, plus the previous state in an
+   incremental scan and the banner if there is one.  `probed' is FALSE for
+   the targets that couldn't be probed at all. */
+
+static void scan_print_result(const scan_slot_t *slot, int err, bool probed,
+			      nc_scanstate_t prev, unsigned long long rtt)
+{
+  const char *host = scan_strhost(&slot->target);
+  unsigned short port = ntohs(slot->target.addr.sin_port);
+  const char *proto = (scan_sock->proto == NETCAT_PROTO_UDP ? "udp" : "tcp");
+  bool banner = ((err == 0) && (slot->banner_len > 0));
+
+  if (opt_format == NETCAT_FORMAT_CSV) {
+    /* host,port,proto,state,latency_us,attempts,previous,banner */
+    scan_print_escaped(host, strlen(host));
+    if (port)
+      printf(",%hu", port);
+    else
+      putchar(',');
+    printf(",%s,%s,", proto, scan_strstate(err));
+    if (probed)
+      printf("%llu,%d", rtt, slot->tries);
+    else
+      putchar(',');
+    printf(",%s,", (opt_since >= 0 ? scan_state_names[prev] : ""));
+    if (banner)
+      scan_print_escaped(slot->banner, slot->banner_len);
+  }
+  else {
+    printf("{\"host\":");
+    scan_print_escaped(host, strlen(host));
+    if (port)
+      printf(",\"port\":%hu", port);
+    printf(",\"proto\":\"%s\",\"state\":\"%s\"", proto, scan_strstate(err));
+    if (probed)
+      printf(",\"latency_us\":%llu,\"attempts\":%d", rtt, slot->tries);
+    if (opt_since >= 0)
+      printf(",\"previous\":\"%s\"", scan_state_names[prev]);
+    if (banner) {
+      printf(",\"banner\":");
+      scan_print_escaped(slot->banner, slot->banner_len);
+    }
+    putchar('}');
+  }
+  putchar('\n');
+  fflush(stdout);
+}
+
+/* Adds the outcome of a probe to the statistics of the scan */
+
+static void scan_account(int err, unsigned long long rtt)
+{
+  unsigned int i;
+
+  if (err == SCAN_ERR_UNRESOLVED) {
+    scan_stats.unresolved++;
+    return;
+  }
+  if (err == SCAN_ERR_INVALID) {
+    scan_stats.invalid++;
+    return;
+  }
+
+  scan_stats.states[scan_state(err)]++;
+  if (err != 0)
+    return;
+
+  for (i = 0; (i < SCAN_LAT_BUCKETS - 1) && (rtt >= scan_lat_bounds[i]); i++);
+  scan_stats.lat_hist[i]++;
+  if (!scan_stats.lat_count || (rtt < scan_stats.lat_min))
+    scan_stats.lat_min = rtt;
+  if (rtt > scan_stats.lat_max)
+    scan_stats.lat_max = rtt;
+  scan_stats.lat_sum += rtt;
+  scan_stats.lat_count++;
+}
+
+/* Appends the formatted text to the string of `*len' bytes held by `buf',
+   which is `size' bytes long.  The text that doesn't fit is cut, and `*len'
+   never goes past the end of the buffer. */
+
+static void scan_append(char *buf, size_t size, size_t *len,
+			const char *fmt, ...)
+{
+  va_list ap;
+  int ret;
+
+  if (*len >= size - 1)
+    return;
+  va_start(ap, fmt);
+  ret = vsnprintf(buf + *len, size - *len, fmt, ap);
+  va_end(ap);
+  if (ret > 0)
+    *len += ret;
+  if (*len >= size)
+    *len = size - 1;
+}
+
+/* Prints the summary of the scan: the number of targets in each state, and
+   the histogram of the latency of the open ports. */
+
+static void scan_print_summary(void)
+{
+  char buf[256];
+  unsigned long max = 0;
+  unsigned int i;
+  size_t len = 0;
+
+  for (i = NETCAT_STATE_OPEN; i <= NETCAT_STATE_ERROR; i++)
+    if (scan_stats.states[i])
+      scan_append(buf, sizeof(buf), &len, ", %lu %s", scan_stats.states[i],
+		  scan_state_names[i]);
+  if (scan_stats.unresolved)
+    scan_append(buf, sizeof(buf), &len, ", %lu unresolved",
+		scan_stats.unresolved);
+  if (scan_stats.invalid)
+    scan_append(buf, sizeof(buf), &len, ", %lu invalid",
+		scan_stats.invalid);
+  if (!len)
+    return;
+  ncprint(NCPRINT_VERB2, _("Scan summary: %s"), buf + 2);
+
+  if (!scan_stats.lat_count)
+    return;
+  ncprint(NCPRINT_VERB2, _("Open ports latency: min %llu us, avg %llu us, max %llu us"),
+	  scan_stats.lat_min, scan_stats.lat_sum / scan_stats.lat_count,
+	  scan_stats.lat_max);
+
+  for (i = 0; i < SCAN_LAT_BUCKETS; i++)
+    if (scan_stats.lat_hist[i] > max)
+      max = scan_stats.lat_hist[i];
+  for (i = 0; i < SCAN_LAT_BUCKETS; i++) {
+    int bar = (int)((scan_stats.lat_hist[i] * 40 + max - 1) / max);
+
+    buf[0] = ' ';
+    memset(buf + 1, '#', bar);
+    buf[bar ? bar + 1 : 0] = 0;
+    ncprint(NCPRINT_VERB2, "  %-6s %8lu%s", scan_lat_names[i],
+	    scan_stats.lat_hist[i], buf);
+  }
+}
+
+/* Reports the outcome of the probe held by `slot' and frees the slot.  An
+   `err' value of 0 means that the port is open.  If `results' is set, a
+   result line is also printed on stdout for each probe.  In banner mode, the
+   banner of each open port is printed on stdout too, at the end of the result
+   line or on a "host:port banner" line of its own.
+   With a state file the result is recorded, and an incremental scan only
+   reports the targets whose state changed, appending the previous state to
+   the result line.  With `opt_format' the result line is printed in that
+   format instead. */
+
+static void scan_finish(scan_slot_t *slot, int err, bool multi, bool results)
+{
+  const scan_target_t *target = &slot->target;
+  bool banner = ((err == 0) && (slot->banner_len > 0));
+  bool probed = ((err != SCAN_ERR_UNRESOLVED) && (err != SCAN_ERR_INVALID));
+  nc_scanstate_t prev = NETCAT_STATE_UNKNOWN;
+  unsigned long long end, rtt = 0;
+
+  /* the latency is measured up to the connection, not the banner */
+  end = (slot->answered ? slot->answered : netcat_time_usec());
+  if (probed && (end > slot->started))
+    rtt = end - slot->started;
+  scan_account(err, rtt);
+
+  if (opt_statefile && probed) {
+    nc_scanstate_t state = scan_state(err);
+
+    prev = netcat_state_get(target->addr.sin_addr,
+			    ntohs(target->addr.sin_port), scan_sock->proto, NULL);
+    netcat_state_set(target->addr.sin_addr, ntohs(target->addr.sin_port),
+		     scan_sock->proto, state,
+		     (rtt > 0xFFFFFFFFULL ? 0xFFFFFFFFUL : (unsigned long)rtt));
+    if ((opt_since >= 0) && (state == prev))
+      goto done;
+  }
+
+  if (opt_format != NETCAT_FORMAT_TEXT)
+    scan_print_result(slot, err, probed, prev, rtt);
+  else if (results || banner) {
+    /* "host:port state", one line per target, flushed as soon as known */
+    char port[8];
+
+    printf("%s:%s", scan_strhost(target),
+	   scan_strport(target, port, sizeof(port)));
+    if (results)
+      printf(" %s", scan_strstate(err));
+    if (opt_since >= 0)
+      printf(" %s", scan_state_names[prev]);
+    if (banner) {
+      putchar(' ');
+      scan_print_escaped(slot->banner, slot->banner_len);
+    }
+    putchar('\n');
+    fflush(stdout);
+  }
+
+  /* the messages are skipped altogether when they can't be printed, so that
+     the full strings of the target are never built in a quiet scan */
+  if (!is_logging_enabled())
+    goto done;
+  if ((err == 0) || (err == SCAN_ERR_NOREPLY))
+    ncprint(NCPRINT_VERB1, "%s %s", scan_strid(target), scan_strstate(err));
+  else if (err == SCAN_ERR_UNRESOLVED)
+    ncprint(NCPRINT_VERB1, _("Couldn't resolve host \"%s\""), target->name);
+  else if (err == SCAN_ERR_INVALID)
+    ncprint(NCPRINT_VERB1, _("Invalid target specification: %s"),
+	    scan_strhost(target));
+  else if (err == SCAN_ERR_FILTERED)
+    ncprint((multi ? NCPRINT_VERB2 : NCPRINT_VERB1), "%s %s",
+	    scan_strid(target), scan_strstate(err));
+  else
+    ncprint((multi ? NCPRINT_VERB2 : NCPRINT_VERB1), "%s: %s",
+	    scan_strid(target), strerror(err));
+
+ done:
+  scan_release(slot->target.name);
+  scan_release(slot->target.port_text);
+  slot->target.name = NULL;
+  slot->target.port_text = NULL;
+  slot->fd = -1;
+  slot->tries = 0;
+  slot->answered = 0;
+  slot->reading = FALSE;
+  slot->banner_len = 0;
+}
+
+/* Runs the TCP scan: each probe is a nonblocking connect() with its own
+   socket, and the result is collected as soon as the socket becomes
+   writable.  In banner mode the probe of an open port stays in its slot
+   until `opt_banner' bytes are received, the peer closes the connection or
+   the read deadline expires, so that banners are grabbed concurrently too.
+   When the ephemeral ports run out, the probe is kept pending in its slot
+   and started again as soon as another probe completes.
+   Returns the number of open ports found. */
+
+static int scan_tcp(const nc_sock_t *ncsock, scan_sched_t *sched,
+		    scan_slot_t *slots, int parallel, bool multi, bool results)
+{
+  int i, active = 0, pending = 0, found = 0;
+  unsigned long seq = 0;
+  bool more = TRUE;
+  unsigned long long banner_wait;
+  scan_bucket_t bucket;
+
+  /* `-w' is also the timeout for the final net reads */
+  banner_wait = (ncsock->timeout > 0 ? ncsock->timeout : NETCAT_BANNER_WAIT) *
+		1000000ULL;
+  scan_bucket_init(&bucket);
+
+  while (more || active || pending) {
+    int ret, fd_max = 0;
+    unsigned long long now, next_deadline = 0;
+    bool waiting = FALSE, throttled;
+    struct timeval tt;
+    fd_set ins, outs;
+
+    /* fill all the free slots with new probes, retrying the pending ones, as
+       long as the rate limit allows it */
+    now = netcat_time_usec();
+    for (i = 0; (more || pending) && (i < parallel) &&
+	 scan_bucket_ready(&bucket, now); i++) {
+      int err;
+
+      if (slots[i].fd >= 0)
+	continue;
+
+      if (slots[i].pending) {
+	slots[i].pending = FALSE;
+	pending--;
+      }
+      else if (!more)
+	continue;
+      else {
+	ret = scan_next(sched, &slots[i].target, &err);
+	if (ret < 0)
+	  more = FALSE;
+	if (ret <= 0) {
+	  waiting = more;
+	  break;
+	}
+	if (err) {
+	  scan_finish(&slots[i], err, multi, results);
+	  continue;
+	}
+	scan_pick_source(&slots[i], seq++);
+      }
+
+      scan_bucket_take(&bucket);
+      if (scan_start(&slots[i]) >= 0)
+	active++;
+      else if ((errno == EADDRNOTAVAIL) && active) {
+	/* out of local ports, wait for the running probes to free some */
+	slots[i].pending = TRUE;
+	pending++;
+	break;
+      }
+      else
+	scan_finish(&slots[i], errno, multi, results);
+    }
+    throttled = ((more || pending) && !waiting &&
+		 !scan_bucket_ready(&bucket, now));
+
+    if (!active && !waiting && !throttled)
+      continue;
+
+    FD_ZERO(&ins);
+    FD_ZERO(&outs);
+    if (waiting)
+      fd_max = scan_wait_sched(sched, &ins, &next_deadline);
+    for (i = 0; i < parallel; i++) {
+      if (slots[i].fd < 0)
+	continue;
+      FD_SET(slots[i].fd, (slots[i].reading ? &ins : &outs));
+      if (slots[i].fd >= fd_max)
+	fd_max = slots[i].fd + 1;
+      if (slots[i].deadline &&
+	  (!next_deadline || (slots[i].deadline < next_deadline)))
+	next_deadline = slots[i].deadline;
+    }
+
+    /* wait until the first probe completes or the nearest deadline, waking
+       up when the rate limit allows to start the next probe */
+    now = netcat_time_usec();
+    if (throttled) {
+      unsigned long long when = scan_bucket_when(&bucket, now);
+
+      if (!next_deadline || (when < next_deadline))
+	next_deadline = when;
+    }
+    if (next_deadline) {
+      unsigned long long wait = (next_deadline > now ? next_deadline - now : 0);
+
+      tt.tv_sec = wait / 1000000;
+      tt.tv_usec = wait % 1000000;
+    }
+
+    ret = select(fd_max, &ins, &outs, NULL, (next_deadline ? &tt : NULL));
+    if (ret < 0) {
+      if (errno == EINTR)
+	continue;
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT, "Critical system request failed: %s",
+	      strerror(errno));
+    }
+    netcat_dns_process();
+
+    now = netcat_time_usec();
+    for (i = 0; i < parallel; i++) {
+      int getret = 0;
+      unsigned int getret_len = sizeof(getret);
+
+      if (slots[i].fd < 0)
+	continue;
+
+      if (slots[i].reading) {
+	if (FD_ISSET(slots[i].fd, &ins)) {
+	  ret = read(slots[i].fd, slots[i].banner + slots[i].banner_len,
+		     opt_banner - slots[i].banner_len);
+	  if (ret > 0)
+	    slots[i].banner_len += ret;
+	  if ((ret > 0) && (slots[i].banner_len < opt_banner))
+	    continue;
+	}
+	else if (now < slots[i].deadline)
+	  continue;
+
+	/* the banner is complete (or it's all we are going to get) */
+	scan_close(&slots[i]);
+	scan_finish(&slots[i], 0, multi, results);
+	active--;
+	continue;
+      }
+
+      if (FD_ISSET(slots[i].fd, &outs)) {
+	/* fetch the result of the asynchronous connection */
+	if (getsockopt(slots[i].fd, SOL_SOCKET, SO_ERROR, &getret,
+		       &getret_len) < 0)
+	  getret = errno;
+      }
+      else if (slots[i].deadline && (now >= slots[i].deadline))
+	getret = ETIMEDOUT;
+      else
+	continue;
+
+      debug_v(("Probe to %s returned errcode=%d",
+	      netcat_inet_ntop(AF_INET, &slots[i].target.addr.sin_addr), getret));
+      slots[i].answered = now;
+      if (getret == 0) {
+	found++;
+	if (slots[i].banner) {
+	  slots[i].reading = TRUE;
+	  slots[i].deadline = now + banner_wait;
+	  continue;
+	}
+      }
+      scan_close(&slots[i]);
+      scan_finish(&slots[i], getret, multi, results);
+      active--;
+    }
+  }
+
+  return found;
+}
+
+/* Finds the busy slot whose probe was sent to the address `addr' */
+
+static scan_slot_t *scan_lookup(scan_slot_t *slots, int parallel,
+				const struct sockaddr_in *addr)
+{
+  int i;
+
+  for (i = 0; i < parallel; i++) {
+    const struct sockaddr_in *target = &slots[i].target.addr;
+
+    if ((slots[i].fd >= 0) && (target->sin_port == addr->sin_port) &&
+	(target->sin_addr.s_addr == addr->sin_addr.s_addr))
+      return &slots[i];
+  }
+  return NULL;
+}
+
+/* Sends a UDP probe to the target held by `slot' through the unconnected
+   socket of the engine, using the payload registered for the destination
+   port.  Returns 0 on success or an errno value. */
+
+static int scan_udp_send(scan_engine_t *engine, scan_slot_t *slot)
+{
+  const struct sockaddr_in *dest = &slot->target.addr;
+  const char *data;
+  size_t len;
+  int tries;
+
+  /* well-known services get a valid request, the others an empty datagram */
+  if (!(data = netcat_probes_get(ntohs(dest->sin_port), &len)))
+    data = "";
+
+  /* an error caused by a previous probe may be reported here instead, but it
+     is still waiting in the error queue, so just send the datagram again */
+  for (tries = 0; tries < 2; tries++)
+    if (sendto(engine->sock, data, len, 0, (const struct sockaddr *)dest,
+	       sizeof(*dest)) >= 0)
+      return 0;
+  return errno;
+}
+
+/* Collects all the answers and the ICMP errors pending on the UDP socket
+   and completes the matching probes.  Late answers to probes that were
+   already given up are ignored.  Returns the number of open ports found. */
+
+static int scan_udp_collect(scan_engine_t *engine, scan_slot_t *slots,
+			    int parallel, int *active, bool multi, bool results)
+{
+  int sock = engine->sock;
+  struct sockaddr_in from;
+  unsigned int from_len;
+  scan_slot_t *slot;
+  char buf[1024];
+  int len, found = 0;
+
+#ifdef USE_RECVERR
+  while (TRUE) {
+    char cbuf[512];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    /* the error queue holds a copy of the offending datagram, addressed to
+       the target it was sent to */
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof(from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      break;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      struct sock_extended_err *ee;
+      int err;
+
+      if ((cmsg->cmsg_level != SOL_IP) || (cmsg->cmsg_type != IP_RECVERR))
+	continue;
+      ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+      if ((ee->ee_origin != SO_EE_ORIGIN_ICMP) ||
+	  !(slot = scan_lookup(slots, parallel, &from)))
+	continue;
+
+      /* destination unreachable: port (3), or administratively prohibited
+	 for network (9), host (10) or communication (13) */
+      if ((ee->ee_type == 3) && (ee->ee_code == 3))
+	err = ECONNREFUSED;
+      else if ((ee->ee_type == 3) &&
+	       ((ee->ee_code == 9) || (ee->ee_code == 10) || (ee->ee_code == 13)))
+	err = SCAN_ERR_FILTERED;
+      else
+	err = ee->ee_errno;
+
+      debug_v(("ICMP type=%d code=%d for %s:%hu", ee->ee_type, ee->ee_code,
+	      netcat_inet_ntop(AF_INET, &slot->target.addr.sin_addr),
+	      ntohs(slot->target.addr.sin_port)));
+      scan_finish(slot, err, multi, results);
+      (*active)--;
+    }
+  }
+#endif
+
+  while (TRUE) {
+    from_len = sizeof(from);
+    if ((len = recvfrom(sock, buf, sizeof(buf), MSG_DONTWAIT,
+			(struct sockaddr *)&from, &from_len)) < 0) {
+      /* pending errors are reported just once, and they are also queued in
+	 the error queue, so they can safely be skipped */
+      if ((errno == ECONNREFUSED) || (errno == EHOSTUNREACH) ||
+	  (errno == ENETUNREACH) || (errno == EINTR))
+	continue;
+      break;
+    }
+
+    if ((slot = scan_lookup(slots, parallel, &from))) {
+      /* the answer itself is the banner of a UDP service */
+      if (slot->banner) {
+	slot->banner_len = (len < opt_banner ? len : opt_banner);
+	memcpy(slot->banner, buf, slot->banner_len);
+      }
+      found++;
+      scan_finish(slot, 0, multi, results);
+      (*active)--;
+    }
+  }
+
+  return found;
+}
+
+/* Computes the sequence number of the SYN sent to `addr':`port'.  The
+   answers are recognized from their acknowledgment number, so no per-probe
+   state is needed to tell them from stray packets. */
+
+static unsigned long scan_syn_cookie(const scan_engine_t *engine,
+				     struct in_addr addr, in_port_t port)
+{
+  unsigned long seq = (ntohl(addr.s_addr) * 2654435761UL) ^ engine->secret;
+
+  return (seq ^ ((unsigned long)ntohs(port) << 16) ^ ntohs(port)) &
+	 0xFFFFFFFFUL;
+}
+
+/* Sums the 16 bits words of `data' into `sum', for the Internet checksum */
+
+static unsigned long scan_cksum_add(unsigned long sum, const unsigned char *data,
+				    int len)
+{
+  int i;
+
+  for (i = 0; i + 1 < len; i += 2)
+    sum += (data[i] << 8) | data[i + 1];
+  if (len & 1)
+    sum += data[len - 1] << 8;
+  return sum;
+}
+
+/* Sends a TCP SYN to the target held by `slot' through the raw socket of the
+   engine.  The source address is the one the kernel would pick for this
+   destination, since it's part of the checksum.  Returns 0 on success or an
+   errno value. */
+
+static int scan_syn_send(scan_engine_t *engine, scan_slot_t *slot)
+{
+  struct sockaddr_in dest, src;
+  unsigned int src_len = sizeof(src);
+  unsigned char pkt[24], pseudo[12];
+  unsigned long seq, sum;
+
+  memset(&dest, 0, sizeof(dest));
+  dest.sin_family = AF_INET;
+  dest.sin_addr = slot->target.addr.sin_addr;
+
+  /* ask the routing table for the source address, unless it was given */
+  if (engine->source.s_addr)
+    memcpy(&src.sin_addr, &engine->source, sizeof(src.sin_addr));
+  else {
+    dest.sin_port = slot->target.addr.sin_port;
+    if ((connect(engine->route_fd, (struct sockaddr *)&dest, sizeof(dest)) < 0) ||
+	(getsockname(engine->route_fd, (struct sockaddr *)&src, &src_len) < 0))
+      return errno;
+    dest.sin_port = 0;
+  }
+
+  /* TCP header with the MSS option, as any real SYN has */
+  seq = scan_syn_cookie(engine, dest.sin_addr, slot->target.addr.sin_port);
+  memset(pkt, 0, sizeof(pkt));
+  memcpy(&pkt[0], &engine->source_port, 2);
+  memcpy(&pkt[2], &slot->target.addr.sin_port, 2);
+  pkt[4] = (seq >> 24) & 0xFF;
+  pkt[5] = (seq >> 16) & 0xFF;
+  pkt[6] = (seq >> 8) & 0xFF;
+  pkt[7] = seq & 0xFF;
+  pkt[12] = (sizeof(pkt) / 4) << 4;	/* data offset */
+  pkt[13] = 0x02;			/* SYN */
+  pkt[14] = 0x04;			/* window: 1024 */
+  pkt[20] = 2;				/* MSS option: 1460 */
+  pkt[21] = 4;
+  pkt[22] = 1460 >> 8;
+  pkt[23] = 1460 & 0xFF;
+
+  memcpy(&pseudo[0], &src.sin_addr, 4);
+  memcpy(&pseudo[4], &dest.sin_addr, 4);
+  pseudo[8] = 0;
+  pseudo[9] = IPPROTO_TCP;
+  pseudo[10] = 0;
+  pseudo[11] = sizeof(pkt);
+  sum = scan_cksum_add(scan_cksum_add(0, pseudo, sizeof(pseudo)), pkt,
+		       sizeof(pkt));
+  while (sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = ~sum & 0xFFFF;
+  pkt[16] = sum >> 8;
+  pkt[17] = sum & 0xFF;
+
+  if (sendto(engine->sock, pkt, sizeof(pkt), 0, (struct sockaddr *)&dest,
+	     sizeof(dest)) < 0)
+    return errno;
+  return 0;
+}
+
+/* Reads all the TCP segments pending on the raw socket and completes the
+   probes they answer: a SYN/ACK means that the port is open, a RST that it
+   is closed.  Our kernel has no socket for these connections, so it resets
+   them by itself and no handshake is ever completed.
+   Returns the number of open ports found. */
+
+static int scan_syn_collect(scan_engine_t *engine, scan_slot_t *slots,
+			    int parallel, int *active, bool multi, bool results)
+{
+  unsigned char buf[256];
+  int len, found = 0;
+
+  while ((len = recv(engine->sock, buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+    struct sockaddr_in from;
+    unsigned char *tcp;
+    unsigned long ack;
+    scan_slot_t *slot;
+    int hlen = (buf[0] & 0x0F) * 4;
+
+    /* the raw socket gets the whole IP datagram */
+    if ((len < hlen + 20) || (buf[9] != IPPROTO_TCP))
+      continue;
+    tcp = buf + hlen;
+    if (memcmp(&tcp[2], &engine->source_port, 2) || !(tcp[13] & 0x10))
+      continue;			/* not for us, or not an ACK */
+
+    memset(&from, 0, sizeof(from));
+    memcpy(&from.sin_addr, &buf[12], 4);
+    memcpy(&from.sin_port, &tcp[0], 2);
+    if (!(slot = scan_lookup(slots, parallel, &from)))
+      continue;
+
+    ack = ((unsigned long)tcp[8] << 24) | ((unsigned long)tcp[9] << 16) |
+	  ((unsigned long)tcp[10] << 8) | tcp[11];
+    if (ack != ((scan_syn_cookie(engine, from.sin_addr, from.sin_port) + 1) &
+		0xFFFFFFFFUL))
+      continue;
+
+    if (tcp[13] & 0x04) {	/* RST */
+      scan_finish(slot, ECONNREFUSED, multi, results);
+      (*active)--;
+    }
+    else if (tcp[13] & 0x02) {	/* SYN */
+      found++;
+      scan_finish(slot, 0, multi, results);
+      (*active)--;
+    }
+  }
+
+  return found;
+}
+
+/* Runs a stateless scan with the given `engine': all the probes are sent
+   from the same socket, and the answers are matched to the probes by the
+   engine's collect function.  Unanswered probes are sent again up to
+   `opt_retries' times, after which they are completed with the engine's
+   `noreply' outcome.  Both the probes and their retransmissions are subject
+   to the rate limit.  Returns the number of open (or possibly open) ports found. */
+
+static int scan_stateless(scan_engine_t *engine, const nc_sock_t *ncsock,
+			  scan_sched_t *sched, scan_slot_t *slots,
+			  int parallel, bool multi, bool results)
+{
+  int i, active = 0, found = 0;
+  bool more = TRUE;
+  unsigned long long timeout;
+  scan_bucket_t bucket;
+
+  timeout = (ncsock->timeout > 0 ? ncsock->timeout : NETCAT_UDP_TIMEOUT) *
+	    1000000ULL;
+  scan_bucket_init(&bucket);
+
+  while (more || active) {
+    int ret, fd_max = 0;
+    unsigned long long now, next_send, next_deadline = 0;
+    bool waiting = FALSE;
+    struct timeval tt;
+    fd_set ins;
+
+    /* send the new probes, as long as the rate limit allows it */
+    now = netcat_time_usec();
+    for (i = 0; more && (i < parallel) && scan_bucket_ready(&bucket, now);
+	 i++) {
+      int err;
+
+      if (slots[i].fd >= 0)
+	continue;
+
+      ret = scan_next(sched, &slots[i].target, &err);
+      if (ret < 0)
+	more = FALSE;
+      if (ret <= 0) {
+	waiting = more;
+	break;
+      }
+
+      slots[i].started = now;
+      if (!err) {
+	scan_bucket_take(&bucket);
+	slots[i].tries = 1;
+	err = engine->send(engine, &slots[i]);
+      }
+      if (err) {
+	scan_finish(&slots[i], err, multi, results);
+	continue;
+      }
+
+      slots[i].fd = engine->sock;
+      slots[i].deadline = now + timeout;
+      active++;
+    }
+
+    /* send again the unanswered probes, or give them up */
+    for (i = 0; i < parallel; i++) {
+      int err;
+
+      if ((slots[i].fd < 0) || (now < slots[i].deadline))
+	continue;
+
+      if (slots[i].tries > opt_retries) {
+	if (engine->noreply == SCAN_ERR_NOREPLY)
+	  found++;
+	scan_finish(&slots[i], engine->noreply, multi, results);
+	active--;
+	continue;
+      }
+      if (!scan_bucket_ready(&bucket, now))
+	continue;
+
+      debug_v(("Retransmitting probe to %s:%hu",
+	      netcat_inet_ntop(AF_INET, &slots[i].target.addr.sin_addr),
+	      ntohs(slots[i].target.addr.sin_port)));
+      slots[i].started = now;
+      slots[i].tries++;
+      scan_bucket_take(&bucket);
+      if ((err = engine->send(engine, &slots[i]))) {
+	scan_finish(&slots[i], err, multi, results);
+	active--;
+	continue;
+      }
+      slots[i].deadline = now + timeout;
+    }
+
+    /* nothing to wait for, unless the rate limit holds back the next probe */
+    next_send = scan_bucket_when(&bucket, now);
+    if (!active && !waiting && !(more && (next_send > now)))
+      continue;
+
+    FD_ZERO(&ins);
+    if (waiting)
+      fd_max = scan_wait_sched(sched, &ins, &next_deadline);
+    if (active) {
+      FD_SET(engine->sock, &ins);
+      if (engine->sock >= fd_max)
+	fd_max = engine->sock + 1;
+    }
+    for (i = 0; i < parallel; i++) {
+      unsigned long long when = slots[i].deadline;
+
+      /* an expired probe is only waiting for the rate limit */
+      if (slots[i].fd < 0)
+	continue;
+      if (when <= now)
+	when = next_send;
+      if (!next_deadline || (when < next_deadline))
+	next_deadline = when;
+    }
+
+    /* wake up when the rate limit allows to send the next probe */
+    if (more && !waiting && (next_send > now) &&
+	(!next_deadline || (next_send < next_deadline)))
+      next_deadline = next_send;
+
+    if (next_deadline) {
+      unsigned long long wait = (next_deadline > now ? next_deadline - now : 0);
+
+      tt.tv_sec = wait / 1000000;
+      tt.tv_usec = wait % 1000000;
+    }
+
+    ret = select(fd_max, &ins, NULL, NULL, (next_deadline ? &tt : NULL));
+    if (ret < 0) {
+      if (errno == EINTR)
+	continue;
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT, "Critical system request failed: %s",
+	      strerror(errno));
+    }
+
+    netcat_dns_process();
+    if ((ret > 0) && FD_ISSET(engine->sock, &ins))
+      found += engine->collect(engine, slots, parallel, &active, multi,
+			       results);
+  }
+
+  return found;
+}
+
+/* Runs the UDP scan.  All the probes are sent from a single unconnected
+   socket: an answer datagram means that the port is open, while the ICMP
+   errors are fetched from the socket error queue.  Unanswered probes are
+   reported as open|filtered.  When `opt_rate' is set, datagrams are paced
+   so that the target's ICMP rate limit doesn't make closed ports look
+   silent.  Returns the number of open (or possibly open) ports found. */
+
+static int scan_udp(const nc_sock_t *ncsock, scan_sched_t *sched,
+		    scan_slot_t *slots, int parallel, bool multi, bool results)
+{
+  scan_engine_t engine;
+  int found;
+#ifdef USE_RECVERR
+  int sockopt = 1;
+#endif
+
+  memset(&engine, 0, sizeof(engine));
+  engine.send = scan_udp_send;
+  engine.collect = scan_udp_collect;
+  engine.noreply = SCAN_ERR_NOREPLY;
+
+  engine.sock = netcat_socket_new(ncsock->domain, NETCAT_PROTO_UDP, &ncsock->opts);
+  if (engine.sock < 0)
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT, _("Couldn't create the scanning socket: %s"),
+	    strerror(errno));
+
+  if (ncsock->local_port.netnum || ncsock->local.host.iaddrs[0].s_addr) {
+    if (netcat_bind(engine.sock, ncsock->domain, &ncsock->local,
+		    &ncsock->local_port) < 0)
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT, _("Couldn't bind the scanning socket: %s"),
+	      strerror(errno));
+  }
+
+#ifdef USE_RECVERR
+  if (setsockopt(engine.sock, SOL_IP, IP_RECVERR, &sockopt, sizeof(sockopt)) < 0)
+    ncprint(NCPRINT_WARNING, _("Couldn't enable ICMP errors reporting: %s"),
+	    strerror(errno));
+#else
+  ncprint(NCPRINT_VERB2 | NCPRINT_WARNING,
+	  _("ICMP errors can't be detected, closed ports will look filtered"));
+#endif
+
+  found = scan_stateless(&engine, ncsock, sched, slots, parallel, multi,
+			 results);
+  close(engine.sock);
+  return found;
+}
+
+/* Runs the SYN (half-open) scan.  The SYNs are crafted and sent on a raw
+   socket, which also receives the answers.  The source port is reserved with
+   a TCP socket that is bound but never listening, so that the kernel resets
+   the connections answered with a SYN/ACK.  Unanswered probes time out.
+   This needs the privilege to open raw sockets (CAP_NET_RAW on Linux).
+   Returns the number of open ports found. */
+
+static int scan_syn(const nc_sock_t *ncsock, scan_sched_t *sched,
+		    scan_slot_t *slots, int parallel, bool multi, bool results)
+{
+  scan_engine_t engine;
+  struct sockaddr_in guard;
+  unsigned int guard_len = sizeof(guard);
+  int found;
+
+  memset(&engine, 0, sizeof(engine));
+  engine.send = scan_syn_send;
+  engine.collect = scan_syn_collect;
+  engine.noreply = ETIMEDOUT;
+  engine.secret = (unsigned long)time(NULL) ^ ((unsigned long)getpid() << 16);
+
+  engine.sock = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+  if (engine.sock < 0)
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT,
+	    _("SYN scan requires raw sockets (CAP_NET_RAW): %s"), strerror(errno));
+
+  /* reserve the source port, on the source address if one was given */
+  engine.guard_fd = netcat_socket_new(ncsock->domain, NETCAT_PROTO_TCP,
+				      &ncsock->opts);
+  if ((engine.guard_fd < 0) ||
+      (netcat_bind(engine.guard_fd, ncsock->domain,
+		   (ncsock->local.host.iaddrs[0].s_addr ? &ncsock->local : NULL),
+		   &ncsock->local_port) < 0) ||
+      (getsockname(engine.guard_fd, (struct sockaddr *)&guard, &guard_len) < 0))
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT, _("Couldn't bind the scanning socket: %s"),
+	    strerror(errno));
+  engine.source_port = guard.sin_port;
+
+  if (ncsock->local.host.iaddrs[0].s_addr) {
+    struct sockaddr_in src;
+
+    memset(&src, 0, sizeof(src));
+    src.sin_family = AF_INET;
+    memcpy(&src.sin_addr, &ncsock->local.host.iaddrs[0], sizeof(src.sin_addr));
+    memcpy(&engine.source, &src.sin_addr, sizeof(engine.source));
+    if (bind(engine.sock, (struct sockaddr *)&src, sizeof(src)) < 0)
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT, _("Couldn't bind the scanning socket: %s"),
+	      strerror(errno));
+  }
+  else if ((engine.route_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT, _("Couldn't create the scanning socket: %s"),
+	    strerror(errno));
+
+  debug_v(("scan_syn(): source port %hu", ntohs(engine.source_port)));
+  found = scan_stateless(&engine, ncsock, sched, slots, parallel, multi,
+			 results);
+
+  if (!engine.source.s_addr)
+    close(engine.route_fd);
+  close(engine.guard_fd);
+  close(engine.sock);
+  return found;
+}
+
+/* Scans all the `ports' on all the `targets', or all the targets listed in
+   the stream `list_fd' if it is not negative, keeping up to `parallel' probes
+   in flight at the same time.  The `ncsock' object is used as a template for
+   every probe (protocol, local address, timeout and socket options).
+   Returns the number of open ports found. */
+
+int core_scan(const nc_sock_t *ncsock, nc_targets_t targets, nc_ports_t ports,
+	      int list_fd, int parallel)
+{
+  int i, found;
+  bool multi, results;
+  scan_sched_t *sched;
+  scan_slot_t *slots;
+
+  static bool header = FALSE;
+
+  assert(ncsock && ((targets && ports) || (list_fd >= 0)));
+  debug_v(("core_scan(ncsock=%p, list_fd=%d, parallel=%d)", (void *)ncsock,
+	  list_fd, parallel));
+
+  /* we use select(2), so we can't watch descriptors above FD_SETSIZE */
+  if (parallel < 1)
+    parallel = 1;
+  if (parallel > FD_SETSIZE - 16)
+    parallel = FD_SETSIZE - 16;
+
+  sched = calloc(1, sizeof(*sched));
+  sched->targets = targets;
+  sched->ports = ports;
+  sched->left_ports = netcat_ports_count(ports);
+  sched->list_fd = list_fd;
+
+  /* read the targets list ahead when the names can be resolved concurrently */
+  if ((list_fd >= 0) && netcat_dns_enabled() && !opt_numeric) {
+    sched->ahead_size = parallel;
+    sched->ahead = calloc(parallel, sizeof(*sched->ahead));
+  }
+
+  /* the targets list is read without blocking, so that a slow stream never
+     delays the pending probes */
+  if (list_fd >= 0) {
+    sched->list_flags = fcntl(list_fd, F_GETFL, 0);
+    if (sched->list_flags >= 0)
+      fcntl(list_fd, F_SETFL, sched->list_flags | O_NONBLOCK);
+  }
+
+  /* a targets list always prints the result lines, since it is meant for
+     bulk checks that are processed by other programs.  The same goes for the
+     differences found by an incremental scan. */
+  results = ((list_fd >= 0) || (opt_since >= 0) ||
+	     (opt_format != NETCAT_FORMAT_TEXT));
+  multi = (results ||
+	   ((netcat_targets_count(targets) * sched->left_ports) > 1));
+
+  /* the CSV header is printed once, even if many scans are run */
+  if ((opt_format == NETCAT_FORMAT_CSV) && !header) {
+    printf("host,port,proto,state,latency_us,attempts,previous,banner\n");
+    header = TRUE;
+  }
+  memset(&scan_stats, 0, sizeof(scan_stats));
+
+  slots = calloc(parallel, sizeof(*slots));
+  for (i = 0; i < parallel; i++) {
+    slots[i].fd = -1;
+    if (opt_banner > 0)
+      slots[i].banner = malloc(opt_banner);
+  }
+
+  scan_sock = ncsock;
+  if (ncsock->proto == NETCAT_PROTO_UDP)
+    found = scan_udp(ncsock, sched, slots, parallel, multi, results);
+  else if (opt_syn)
+    found = scan_syn(ncsock, sched, slots, parallel, multi, results);
+  else
+    found = scan_tcp(ncsock, sched, slots, parallel, multi, results);
+
+  scan_print_summary();
+  if (sched->skipped)
+    ncprint(NCPRINT_VERB2, _("Skipped %lu targets checked less than %ld seconds ago"),
+	    sched->skipped, opt_since);
+
+  if ((list_fd >= 0) && (sched->list_flags >= 0))
+    fcntl(list_fd, F_SETFL, sched->list_flags);
+  for (i = 0; i < parallel; i++)
+    free(slots[i].banner);
+  free(sched->ahead);
+  free(sched);
+  free(slots);
+  scan_intern_free();
+  scan_sock = NULL;
+  return found;
+}				/* end of core_scan() */
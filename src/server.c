@@ -0,0 +1,611 @@
+/*
+ * server.c -- multi-peer UDP server, with a session for each peer
+ * Part of the GNU netcat project
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "netcat.h"
+#include <fcntl.h>		/* fcntl() */
+#include <sys/wait.h>		/* waitpid() */
+
+/* The plain UDP listen mode latches onto the first peer.  In server mode a
+   single unconnected socket receives the datagrams of all the peers, which
+   are told apart by their source address and port.  Each peer gets a session
+   which lasts until the peer stays quiet for the idle time.
+
+   Without `-e' the datagrams of all the sessions are written to stdout, and
+   what is read from stdin is sent to all of them.  With `-e' each session
+   gets its own copy of the program, talking to it through a socket pair
+   which keeps the datagram boundaries in both directions. */
+
+#ifdef SOCK_SEQPACKET
+# define SERVER_CHANNEL SOCK_SEQPACKET
+#else
+# define SERVER_CHANNEL SOCK_STREAM
+#endif
+
+#ifdef USE_MMSG
+# define SERVER_BATCH NETCAT_UDP_BATCH
+#else
+# define SERVER_BATCH 1
+#endif
+
+/* Size of the chunks read from stdin, each one sent as a datagram */
+#define SERVER_CHUNK 1024
+
+typedef struct server_session {
+  struct sockaddr_in addr;	/* peer address, the hash key */
+  struct in_addr local;		/* the address the peer writes to */
+  int fd;			/* channel to the program, or -1 */
+  unsigned long long last;	/* time of the last datagram, in usec */
+  struct server_session *next;	/* hash chain */
+  struct server_session *older, *newer;	/* sessions by last activity */
+} server_session_t;
+
+/* The sessions are kept in a chained hash table, whose size is always a power
+   of two, and in a list sorted by the time of the last datagram received.
+   The oldest sessions are at the head of the list, so the expired ones are
+   found without scanning the whole table. */
+
+static server_session_t **server_table = NULL;
+static unsigned long server_size = 0;
+static unsigned long server_count = 0;
+static server_session_t *server_oldest = NULL, *server_newest = NULL;
+static int server_programs = 0;	/* sessions running a program */
+
+#ifdef USE_DSTADDR
+/* Ancillary data buffer, it fits the destination address of the datagram and
+   the counter of the ones dropped by the kernel */
+typedef union {
+  struct cmsghdr hdr;
+  unsigned char buf[NETCAT_DSTADDR_SPACE + CMSG_SPACE(sizeof(unsigned int))];
+} server_cmsg_t;
+#endif
+
+/* Receive buffers for a batch of datagrams */
+
+typedef struct {
+#ifdef USE_MMSG
+  struct mmsghdr msgs[SERVER_BATCH];
+#else
+  struct msghdr msgs[SERVER_BATCH];
+#endif
+  struct iovec iovs[SERVER_BATCH];
+  struct sockaddr_in addrs[SERVER_BATCH];
+#ifdef USE_DSTADDR
+  server_cmsg_t ctrl[SERVER_BATCH];
+#endif
+  unsigned char *bufs;
+#ifndef USE_MMSG
+  int len;			/* length of the datagram received */
+#endif
+} server_batch_t;
+
+#ifdef USE_MMSG
+# define SERVER_HDR(__batch, __i) (&(__batch)->msgs[__i].msg_hdr)
+# define SERVER_LEN(__batch, __i) ((__batch)->msgs[__i].msg_len)
+#else
+# define SERVER_HDR(__batch, __i) (&(__batch)->msgs[__i])
+# define SERVER_LEN(__batch, __i) (__batch)->len
+#endif
+
+static unsigned long server_hash(const struct sockaddr_in *addr)
+{
+  return ((ntohl(addr->sin_addr.s_addr) * 2654435761UL) ^
+	  ntohs(addr->sin_port)) & (server_size - 1);
+}
+
+/* Finds the session of the peer `addr'.  Returns NULL if there is none. */
+
+static server_session_t *server_find(const struct sockaddr_in *addr)
+{
+  server_session_t *s;
+
+  if (!server_table)
+    return NULL;
+  for (s = server_table[server_hash(addr)]; s; s = s->next)
+    if ((s->addr.sin_addr.s_addr == addr->sin_addr.s_addr) &&
+	(s->addr.sin_port == addr->sin_port))
+      return s;
+  return NULL;
+}
+
+/* Moves the session `s' to the newest end of the activity list */
+
+static void server_touch(server_session_t *s, unsigned long long now)
+{
+  s->last = now;
+  if (s == server_newest)
+    return;
+
+  /* unlink it (it may not be linked yet) */
+  if (s->older)
+    s->older->newer = s->newer;
+  if (s->newer)
+    s->newer->older = s->older;
+  if (s == server_oldest)
+    server_oldest = s->newer;
+
+  s->older = server_newest;
+  s->newer = NULL;
+  if (server_newest)
+    server_newest->newer = s;
+  server_newest = s;
+  if (!server_oldest)
+    server_oldest = s;
+}
+
+/* Adds the session `s' to the table, which is grown when it holds more
+   sessions than buckets. */
+
+static void server_insert(server_session_t *s)
+{
+  unsigned long i;
+
+  if (server_count + 1 > server_size) {
+    server_session_t **old = server_table;
+    unsigned long old_size = server_size;
+
+    server_size = (server_size ? server_size * 2 : 1024);
+    server_table = calloc(server_size, sizeof(*server_table));
+    for (i = 0; i < old_size; i++)
+      while (old[i]) {
+	server_session_t *tmp = old[i];
+	unsigned long j;
+
+	old[i] = tmp->next;
+	j = server_hash(&tmp->addr);
+	tmp->next = server_table[j];
+	server_table[j] = tmp;
+      }
+    free(old);
+  }
+
+  i = server_hash(&s->addr);
+  s->next = server_table[i];
+  server_table[i] = s;
+  server_count++;
+}
+
+/* Ends the session `s'.  Closing the channel tells the program that the
+   session is over, it is then reaped by server_reap(). */
+
+static void server_close(server_session_t *s, bool expired)
+{
+  server_session_t **p = &server_table[server_hash(&s->addr)];
+
+  if (expired)
+    ncprint(NCPRINT_VERB2, _("Session %s:%d expired"),
+	    netcat_inet_ntop(AF_INET, &s->addr.sin_addr),
+	    ntohs(s->addr.sin_port));
+  else
+    ncprint(NCPRINT_VERB2, _("Session %s:%d closed"),
+	    netcat_inet_ntop(AF_INET, &s->addr.sin_addr),
+	    ntohs(s->addr.sin_port));
+
+  while (*p != s)
+    p = &(*p)->next;
+  *p = s->next;
+  server_count--;
+
+  if (s->older)
+    s->older->newer = s->newer;
+  else
+    server_oldest = s->newer;
+  if (s->newer)
+    s->newer->older = s->older;
+  else
+    server_newest = s->older;
+
+  if (s->fd >= 0) {
+    close(s->fd);
+    server_programs--;
+  }
+  free(s);
+}
+
+/* Collects the exit status of the programs that terminated */
+
+static void server_reap(void)
+{
+  pid_t pid;
+
+  while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+    debug_v(("server_reap(): pid %d terminated", (int)pid));
+  }
+}
+
+/* Starts a new session for the peer `addr', which wrote to the local address
+   `local'.  With `-e' the program is started as well.  `sock' is the server
+   socket, which the program must not inherit.
+   Returns the new session, or NULL if it can't be created. */
+
+static server_session_t *server_open(int sock, const struct sockaddr_in *addr,
+				     struct in_addr local)
+{
+  server_session_t *s;
+  int pair[2];
+  pid_t pid;
+
+  /* the channels are watched with select(2), so they can't go beyond the
+     FD_SETSIZE limit */
+  if (opt_exec && (server_programs >= FD_SETSIZE - 16)) {
+    ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+	    _("Too many sessions, datagram from %s:%d dropped"),
+	    netcat_inet_ntop(AF_INET, &addr->sin_addr), ntohs(addr->sin_port));
+    dgrams_dropped++;
+    return NULL;
+  }
+
+  s = calloc(1, sizeof(*s));
+  memcpy(&s->addr, addr, sizeof(s->addr));
+  s->local = local;
+  s->fd = -1;
+
+  if (opt_exec) {
+    nc_sock_t child;
+
+    if (socketpair(AF_UNIX, SERVER_CHANNEL, 0, pair) < 0)
+      goto err;
+    /* the programs of the later sessions must not inherit this channel, or
+       this one would never get EOF when its session expires */
+    fcntl(pair[0], F_SETFD, FD_CLOEXEC);
+    if ((pid = fork()) < 0) {
+      close(pair[0]);
+      close(pair[1]);
+      goto err;
+    }
+
+    if (pid == 0) {
+      close(sock);
+      close(pair[0]);
+      memset(&child, 0, sizeof(child));
+      child.fd = pair[1];
+      ncexec(&child);		/* this won't return */
+    }
+
+    close(pair[1]);
+    s->fd = pair[0];
+    /* a program not reading its input must not stall the other sessions */
+    fcntl(s->fd, F_SETFL, fcntl(s->fd, F_GETFL) | O_NONBLOCK);
+    server_programs++;
+  }
+
+  server_insert(s);
+  ncprint(NCPRINT_VERB1, _("Session from %s:%d"),
+	  netcat_inet_ntop(AF_INET, &addr->sin_addr), ntohs(addr->sin_port));
+  return s;
+
+ err:
+  ncprint(NCPRINT_VERB1 | NCPRINT_WARNING, _("Couldn't start session: %s"),
+	  strerror(errno));
+  dgrams_dropped++;
+  free(s);
+  return NULL;
+}
+
+/* Sends the datagram `data' to the peer of the session `s', from the address
+   the peer wrote to. */
+
+static void server_send(int sock, const server_session_t *s,
+			const unsigned char *data, int len)
+{
+  struct msghdr hdr;
+  struct iovec iov;
+#ifdef USE_SENDSRC
+  server_cmsg_t ctrl;
+#endif
+  int ret;
+
+  memset(&hdr, 0, sizeof(hdr));
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  hdr.msg_name = (void *)&s->addr;
+  hdr.msg_namelen = sizeof(s->addr);
+#ifdef USE_SENDSRC
+  if (s->local.s_addr) {
+    hdr.msg_control = ctrl.buf;
+    udphelper_ancillary_src(&hdr, s->local);
+  }
+#endif
+
+  ret = sendmsg(sock, &hdr, 0);
+  debug_dv(("sendmsg(net) = %d", ret));
+  if (ret < 0) {
+    ncprint(NCPRINT_VERB2 | NCPRINT_WARNING, _("Couldn't send to %s:%d: %s"),
+	    netcat_inet_ntop(AF_INET, &s->addr.sin_addr),
+	    ntohs(s->addr.sin_port), strerror(errno));
+    return;
+  }
+  bytes_sent += ret;
+  if (opt_hexdump) {
+#ifndef USE_OLD_HEXDUMP
+    fprintf(output_fp, "Sent %d bytes to %s:%d\n", ret,
+	    netcat_inet_ntop(AF_INET, &s->addr.sin_addr),
+	    ntohs(s->addr.sin_port));
+#endif
+    netcat_fhexdump(output_fp, '>', data, ret);
+  }
+}
+
+/* Hands the datagram `data' received from the session `s' to its program or
+   to stdout. */
+
+static void server_deliver(server_session_t *s, const unsigned char *data,
+			   int len)
+{
+  int ret;
+
+  bytes_recv += len;
+  if (opt_hexdump) {
+#ifndef USE_OLD_HEXDUMP
+    fprintf(output_fp, "Received %d bytes from %s:%d\n", len,
+	    netcat_inet_ntop(AF_INET, &s->addr.sin_addr),
+	    ntohs(s->addr.sin_port));
+#endif
+    netcat_fhexdump(output_fp, '<', data, len);
+  }
+
+  if (s->fd < 0) {
+    ret = netcat_framing_write(STDOUT_FILENO, data, len);
+    debug_dv(("write(stdout) = %d", ret));
+    dgrams_recv++;
+    return;
+  }
+
+  /* a program too slow to keep up loses datagrams, as a socket would */
+  ret = send(s->fd, data, len, 0);
+  debug_dv(("send(session) = %d", ret));
+  if (ret < 0) {
+    dgrams_dropped++;
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      server_close(s, FALSE);
+  }
+  else
+    dgrams_recv++;
+}
+
+/* Receives up to SERVER_BATCH datagrams from the server socket.  Returns the
+   number of datagrams received, or -1 on error. */
+
+static int server_recv(int sock, server_batch_t *batch)
+{
+  int i, ret;
+#if defined(USE_DSTADDR) && defined(USE_RXQ_OVFL)
+  static unsigned int drops = 0;	/* dropped by the kernel so far */
+#endif
+
+  for (i = 0; i < SERVER_BATCH; i++) {
+    struct msghdr *hdr = SERVER_HDR(batch, i);
+
+    memset(hdr, 0, sizeof(*hdr));
+    batch->iovs[i].iov_base = batch->bufs + i * NETCAT_DGRAM_MAX;
+    batch->iovs[i].iov_len = NETCAT_DGRAM_MAX;
+    hdr->msg_iov = &batch->iovs[i];
+    hdr->msg_iovlen = 1;
+    hdr->msg_name = &batch->addrs[i];
+    hdr->msg_namelen = sizeof(batch->addrs[i]);
+#ifdef USE_DSTADDR
+    hdr->msg_control = &batch->ctrl[i];
+    hdr->msg_controllen = sizeof(batch->ctrl[i]);
+#endif
+  }
+
+#ifdef USE_MMSG
+  ret = recvmmsg(sock, batch->msgs, SERVER_BATCH, MSG_DONTWAIT, NULL);
+  debug_dv(("recvmmsg(net) = %d", ret));
+#else
+  ret = recvmsg(sock, &batch->msgs[0], MSG_DONTWAIT);
+  debug_dv(("recvmsg(net) = %d", ret));
+  if (ret >= 0) {
+    batch->len = ret;
+    ret = 1;
+  }
+#endif
+  if ((ret < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+		    (errno == EINTR)))
+    ret = 0;
+#if defined(USE_DSTADDR) && defined(USE_RXQ_OVFL)
+  for (i = 0; i < ret; i++)
+    udphelper_ancillary_drops(SERVER_HDR(batch, i), &drops);
+#endif
+  return ret;
+}
+
+/* Serves the UDP peers on the local address and port of `ncsock', forgetting
+   the sessions idle for more than `idle' seconds.  Returns when a signal
+   tells to, with 0, or -1 if the server socket couldn't be set up. */
+
+int core_udp_server(nc_sock_t *ncsock, int idle)
+{
+  int sock, ret;
+  bool use_in = (use_stdin && !opt_exec);
+  server_batch_t *batch;
+  unsigned char buf[SERVER_CHUNK];
+  nc_framer_t framer;
+
+  assert(ncsock && (idle > 0));
+
+  sock = netcat_socket_new(ncsock->domain, NETCAT_PROTO_UDP, &ncsock->opts);
+  if (sock < 0)
+    return -1;
+  fcntl(sock, F_SETFD, FD_CLOEXEC);
+  if (netcat_bind(sock, ncsock->domain, &ncsock->local, &ncsock->local_port) < 0)
+    goto err;
+#ifdef USE_DSTADDR
+  /* the replies must come from the address each peer wrote to */
+  if (udphelper_dstaddr(sock, TRUE) < 0)
+    goto err;
+#endif
+
+  if (ncsock->local_port.num == 0) {
+    struct sockaddr_in my_addr;
+    unsigned int my_addr_len = sizeof(my_addr);
+
+    if (getsockname(sock, (struct sockaddr *)&my_addr, &my_addr_len) < 0)
+      goto err;
+    netcat_getport(&ncsock->local_port, NULL, ntohs(my_addr.sin_port));
+  }
+  ncsock->fd = sock;
+  ncprint(NCPRINT_VERB2, _("Serving on %s"),
+	  netcat_strid(ncsock->domain, &ncsock->local, &ncsock->local_port));
+
+  batch = malloc(sizeof(*batch));
+  batch->bufs = malloc(SERVER_BATCH * NETCAT_DGRAM_MAX);
+  if (opt_framing)
+    netcat_framer_init(&framer);
+
+  /* use the internal signal handler */
+  signal_handler = FALSE;
+
+  while (TRUE) {
+    fd_set ins;
+    int fd_max = sock + 1;
+    struct timeval tt;
+    unsigned long long now;
+    server_session_t *s, *next;
+
+    if (got_sigint) {
+      got_sigint = FALSE;
+      break;
+    }
+    if (got_sigterm)
+      break;
+
+    server_reap();
+
+    FD_ZERO(&ins);
+    FD_SET(sock, &ins);
+    if (use_in)
+      FD_SET(STDIN_FILENO, &ins);
+    for (s = server_oldest; s && server_programs; s = s->newer)
+      if (s->fd >= 0) {
+	FD_SET(s->fd, &ins);
+	if (s->fd >= fd_max)
+	  fd_max = s->fd + 1;
+      }
+
+    /* wake up when the oldest session expires */
+    if (server_oldest) {
+      unsigned long long expire = server_oldest->last + idle * 1000000ULL;
+
+      now = netcat_time_usec();
+      now = (expire > now ? expire - now : 0);
+      tt.tv_sec = now / 1000000;
+      tt.tv_usec = now % 1000000;
+    }
+
+    ret = select(fd_max, &ins, NULL, NULL, (server_oldest ? &tt : NULL));
+    if (ret < 0) {
+      if (errno == EINTR)
+	continue;
+      ncprint(NCPRINT_ERROR | NCPRINT_EXIT, "Critical system request failed: %s",
+	      strerror(errno));
+    }
+    now = netcat_time_usec();
+
+    while (server_oldest && (server_oldest->last + idle * 1000000ULL <= now))
+      server_close(server_oldest, TRUE);
+
+    if (FD_ISSET(sock, &ins)) {
+      int i, n = server_recv(sock, batch);
+
+      for (i = 0; i < n; i++) {
+	struct msghdr *hdr = SERVER_HDR(batch, i);
+	struct sockaddr_in local;
+
+	memset(&local, 0, sizeof(local));
+#ifdef USE_DSTADDR
+	udphelper_ancillary_read(hdr, &local);
+#endif
+	if (hdr->msg_flags & MSG_TRUNC)
+	  ncprint(NCPRINT_VERB1 | NCPRINT_WARNING,
+		  _("Datagram from %s:%d truncated to %d bytes"),
+		  netcat_inet_ntop(AF_INET, &batch->addrs[i].sin_addr),
+		  ntohs(batch->addrs[i].sin_port), (int)SERVER_LEN(batch, i));
+
+	if (!(s = server_find(&batch->addrs[i])) &&
+	    !(s = server_open(sock, &batch->addrs[i], local.sin_addr)))
+	  continue;
+	server_touch(s, now);
+	server_deliver(s, batch->iovs[i].iov_base, SERVER_LEN(batch, i));
+      }
+    }
+
+    /* what is read from stdin goes to all the sessions, a record at a time
+       with `--framing' */
+    if (use_in && FD_ISSET(STDIN_FILENO, &ins)) {
+      if (opt_framing) {
+	unsigned char *data;
+	size_t len;
+
+	ret = netcat_framer_fill(&framer, STDIN_FILENO);
+	while (netcat_framer_next(&framer, &data, &len))
+	  for (s = server_oldest; s; s = s->newer)
+	    server_send(sock, s, data, len);
+      }
+      else {
+	ret = read(STDIN_FILENO, buf, sizeof(buf));
+	if (ret > 0)
+	  for (s = server_oldest; s; s = s->newer)
+	    server_send(sock, s, buf, ret);
+      }
+      debug_dv(("read(stdin) = %d", ret));
+      if (ret <= 0) {
+	use_in = FALSE;
+	if (opt_eofclose)
+	  break;
+      }
+    }
+
+    /* the output of the programs goes to their own peers */
+    for (s = server_oldest; s && server_programs; s = next) {
+      next = s->newer;
+      if ((s->fd < 0) || !FD_ISSET(s->fd, &ins))
+	continue;
+      ret = recv(s->fd, batch->bufs, NETCAT_DGRAM_MAX, MSG_DONTWAIT);
+      debug_dv(("recv(session) = %d", ret));
+      if (ret > 0)
+	server_send(sock, s, batch->bufs, ret);
+      else if ((ret == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+	server_close(s, FALSE);
+    }
+  }
+
+  while (server_oldest)
+    server_close(server_oldest, FALSE);
+  free(server_table);
+  server_table = NULL;
+  server_size = 0;
+  free(batch->bufs);
+  free(batch);
+  if (opt_framing)
+    netcat_framer_free(&framer);
+  close(sock);
+  return 0;
+
+ err:
+  ret = errno;
+  close(sock);
+  errno = ret;
+  return -1;
+}
@@ -0,0 +1,37 @@
+# services.awk -- compiles a services(5) file into the tables of services.h
+# Part of the GNU netcat project
+#
+# Each output line is a sort key followed by a tab and a C initializer, so
+# that the lines can be sorted with sort(1) and then cut(1).  With
+# `table=port' the entries are keyed by port number and protocol, otherwise
+# by name (aliases included) and protocol.  Only the first entry of each key
+# is kept, like getservbyname(3) and getservbyport(3) do.
+
+{
+  sub(/#.*/, "")
+  if (NF < 2 || split($2, pp, "/") != 2)
+    next
+  port = pp[1] + 0
+  proto = pp[2]
+  if (proto != "tcp" && proto != "udp")
+    next
+  if (port < 1 || port > 65535 || $1 !~ /^[A-Za-z0-9][-A-Za-z0-9_.+]*$/)
+    next
+
+  if (table == "port") {
+    key = sprintf("%05d %s", port, proto)
+    if (!seen[key]++)
+      printf("%s\t  { %d, '%s', \"%s\", NULL },\n", key, port,
+	     substr(proto, 1, 1), $1)
+    next
+  }
+
+  for (i = 1; i <= NF; i++) {
+    if ($i !~ /^[A-Za-z0-9][-A-Za-z0-9_.+]*$/)
+      continue
+    key = $i " " proto
+    if (!seen[key]++)
+      printf("%s\t  { %d, '%s', \"%s\", \"%s\" },\n", key, port,
+	     substr(proto, 1, 1), $1, $i)
+  }
+}
@@ -0,0 +1,257 @@
+/*
+ * state.c -- persistent scan results, for incremental scans
+ * Part of the GNU netcat project
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "netcat.h"
+#include <time.h>		/* time(2) for the records timestamps */
+
+/* The state file starts with an 8 bytes header: the magic string "NCST", the
+   format version and the size of each record, both as 16 bits numbers.  Then
+   follow the records, one for each target ever scanned, with all the fields
+   stored in network byte order:
+
+     offset  size  field
+          0     4  IPv4 address
+          4     2  port
+          6     1  protocol (nc_proto_t)
+          7     1  state (nc_scanstate_t)
+          8     4  round trip time of the last probe, in microseconds
+         12     4  time of the last probe, in seconds since the Epoch */
+
+#define STATE_MAGIC "NCST"
+#define STATE_VERSION 1
+#define STATE_RECSIZE 16
+
+/* In memory the records are kept in an open addressing hash table, whose
+   size is always a power of two.  A free bucket has the state set to
+   NETCAT_STATE_UNKNOWN. */
+
+typedef struct {
+  unsigned long addr;		/* address, in host byte order */
+  unsigned short port;
+  unsigned char proto;
+  unsigned char state;
+  unsigned long rtt;
+  unsigned long stamp;
+} state_rec_t;
+
+static state_rec_t *state_table = NULL;
+static unsigned long state_size = 0;
+static unsigned long state_count = 0;
+
+/* Finds the bucket of the record with the given key, or the free bucket
+   where it should be stored */
+
+static state_rec_t *state_find(unsigned long addr, unsigned short port,
+			       unsigned char proto)
+{
+  unsigned long i = ((addr * 2654435761UL) ^ (port << 4) ^ proto) &
+		    (state_size - 1);
+
+  while ((state_table[i].state != NETCAT_STATE_UNKNOWN) &&
+	 ((state_table[i].addr != addr) || (state_table[i].port != port) ||
+	  (state_table[i].proto != proto)))
+    i = (i + 1) & (state_size - 1);
+
+  return &state_table[i];
+}
+
+/* Stores the record `rec', replacing any older record with the same key.
+   The table is grown when it gets 3/4 full. */
+
+static void state_insert(const state_rec_t *rec)
+{
+  state_rec_t *dst;
+
+  if ((state_count + 1) * 4 > state_size * 3) {
+    state_rec_t *old = state_table;
+    unsigned long i, old_size = state_size;
+
+    state_size = (state_size ? state_size * 2 : 1024);
+    state_table = calloc(state_size, sizeof(*state_table));
+    state_count = 0;
+    for (i = 0; i < old_size; i++)
+      if (old[i].state != NETCAT_STATE_UNKNOWN)
+	state_insert(&old[i]);
+    free(old);
+  }
+
+  dst = state_find(rec->addr, rec->port, rec->proto);
+  if (dst->state == NETCAT_STATE_UNKNOWN)
+    state_count++;
+  memcpy(dst, rec, sizeof(*dst));
+}
+
+static unsigned long state_get32(const unsigned char *p)
+{
+  return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+	 ((unsigned long)p[2] << 8) | p[3];
+}
+
+static void state_put32(unsigned char *p, unsigned long val)
+{
+  p[0] = (val >> 24) & 0xFF;
+  p[1] = (val >> 16) & 0xFF;
+  p[2] = (val >> 8) & 0xFF;
+  p[3] = val & 0xFF;
+}
+
+/* Loads the state file `filename'.  A missing file is not an error, since it
+   just means that this is the first scan.
+   Returns TRUE on success, FALSE if the file can't be read or is not a valid
+   state file (an error message is printed in this case). */
+
+bool netcat_state_load(const char *filename)
+{
+  FILE *fp;
+  unsigned char buf[STATE_RECSIZE];
+
+  if (!(fp = fopen(filename, "rb"))) {
+    if (errno == ENOENT)
+      return TRUE;
+    ncprint(NCPRINT_ERROR, _("Failed to open state file: %s (%s)"), filename,
+	    strerror(errno));
+    return FALSE;
+  }
+
+  if ((fread(buf, 1, 8, fp) != 8) || memcmp(buf, STATE_MAGIC, 4) ||
+      (((buf[4] << 8) | buf[5]) != STATE_VERSION) ||
+      (((buf[6] << 8) | buf[7]) != STATE_RECSIZE)) {
+    ncprint(NCPRINT_ERROR, _("Invalid state file: %s"), filename);
+    fclose(fp);
+    return FALSE;
+  }
+
+  while (fread(buf, 1, STATE_RECSIZE, fp) == STATE_RECSIZE) {
+    state_rec_t rec;
+
+    rec.addr = state_get32(buf);
+    rec.port = (buf[4] << 8) | buf[5];
+    rec.proto = buf[6];
+    rec.state = buf[7];
+    rec.rtt = state_get32(buf + 8);
+    rec.stamp = state_get32(buf + 12);
+    /* the state indexes the tables of names, so a value out of range means
+       the file is corrupt */
+    if (rec.state > NETCAT_STATE_ERROR) {
+      ncprint(NCPRINT_ERROR, _("Invalid state file: %s"), filename);
+      fclose(fp);
+      return FALSE;
+    }
+    if (rec.state != NETCAT_STATE_UNKNOWN)
+      state_insert(&rec);
+  }
+
+  fclose(fp);
+  debug_v(("netcat_state_load(): %lu records loaded", state_count));
+  return TRUE;
+}
+
+/* Writes all the records to the state file `filename'.  The new file is
+   written aside and then renamed, so an interrupted run never leaves a
+   truncated state file behind.
+   Returns TRUE on success, FALSE on failure (an error message is printed). */
+
+bool netcat_state_save(const char *filename)
+{
+  FILE *fp;
+  unsigned long i;
+  unsigned char buf[STATE_RECSIZE];
+  char *tmpname = malloc(strlen(filename) + 5);
+
+  sprintf(tmpname, "%s.tmp", filename);
+  if (!(fp = fopen(tmpname, "wb")))
+    goto err;
+
+  memcpy(buf, STATE_MAGIC, 4);
+  buf[4] = STATE_VERSION >> 8;
+  buf[5] = STATE_VERSION & 0xFF;
+  buf[6] = STATE_RECSIZE >> 8;
+  buf[7] = STATE_RECSIZE & 0xFF;
+  if (fwrite(buf, 1, 8, fp) != 8)
+    goto err_close;
+
+  for (i = 0; i < state_size; i++) {
+    const state_rec_t *rec = &state_table[i];
+
+    if (rec->state == NETCAT_STATE_UNKNOWN)
+      continue;
+    state_put32(buf, rec->addr);
+    buf[4] = rec->port >> 8;
+    buf[5] = rec->port & 0xFF;
+    buf[6] = rec->proto;
+    buf[7] = rec->state;
+    state_put32(buf + 8, rec->rtt);
+    state_put32(buf + 12, rec->stamp);
+    if (fwrite(buf, 1, STATE_RECSIZE, fp) != STATE_RECSIZE)
+      goto err_close;
+  }
+
+  if (fclose(fp) || rename(tmpname, filename))
+    goto err;
+  free(tmpname);
+  return TRUE;
+
+ err_close:
+  fclose(fp);
+ err:
+  ncprint(NCPRINT_ERROR, _("Failed to write state file: %s (%s)"), filename,
+	  strerror(errno));
+  unlink(tmpname);
+  free(tmpname);
+  return FALSE;
+}
+
+/* Fetches the last known state of port `port' of host `addr' for protocol
+   `proto'.  If `stamp' is not NULL it is set to the time of the last probe.
+   Returns NETCAT_STATE_UNKNOWN if the target was never scanned before. */
+
+nc_scanstate_t netcat_state_get(struct in_addr addr, unsigned short port,
+				nc_proto_t proto, unsigned long *stamp)
+{
+  const state_rec_t *rec;
+
+  if (!state_table)
+    return NETCAT_STATE_UNKNOWN;
+
+  rec = state_find(ntohl(addr.s_addr), port, proto);
+  if (stamp)
+    *stamp = rec->stamp;
+  return rec->state;
+}
+
+/* Records the new `state' of the target, found with a probe that took
+   `rtt' microseconds. */
+
+void netcat_state_set(struct in_addr addr, unsigned short port,
+		      nc_proto_t proto, nc_scanstate_t state, unsigned long rtt)
+{
+  state_rec_t rec;
+
+  rec.addr = ntohl(addr.s_addr);
+  rec.port = port;
+  rec.proto = proto;
+  rec.state = state;
+  rec.rtt = rtt;
+  rec.stamp = time(NULL);
+  state_insert(&rec);
+}
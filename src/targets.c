@@ -0,0 +1,255 @@
+/*
+ * targets.c -- keeps track of multiple target hosts and address ranges
+ * Part of the GNU netcat project
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "netcat.h"
+
+/* private struct.  Ranges are never expanded in memory: each node only holds
+   the first and the last address (in host byte order, both inclusive), so a
+   /8 network costs exactly as much as a single host.  Nodes are kept in the
+   order they were specified on the command line. */
+struct nc_targets_st {
+  unsigned long first;	/* first address of the range, inclusive */
+  unsigned long last;	/* last address of the range, inclusive */
+  char *name;		/* hostname this node was resolved from, or NULL */
+  struct nc_targets_st *next;
+};
+
+/* Appends a new range at the end of the chained list */
+
+static void targets_append(nc_targets_t *targets, unsigned long first,
+			   unsigned long last, const char *name)
+{
+  nc_targets_t ins, *tail = targets;
+
+  debug_v(("targets_append(): first=%lx last=%lx name=\"%s\"", first, last,
+	  NULL_STR(name)));
+
+  while (*tail)
+    tail = &(*tail)->next;
+
+  ins = malloc(sizeof(*ins));
+  ins->first = first;
+  ins->last = last;
+  ins->name = (name ? strdup(name) : NULL);
+  ins->next = NULL;
+  *tail = ins;
+}
+
+/* Parses a single target token, which may be a CIDR block (N.N.N.N/BITS), a
+   range (N.N.N.N-M or N.N.N.N-M.M.M.M) or a plain hostname/address.
+   Returns TRUE on success, FALSE if the token is malformed or can't be
+   resolved. */
+
+static bool targets_parse_token(nc_targets_t *targets, char *token)
+{
+  struct in_addr addr;
+  char *sep;
+
+  if ((sep = strchr(token, '/'))) {
+    unsigned long base, mask;
+    char *endptr;
+    long bits;
+
+    *sep++ = 0;
+    bits = strtol(sep, &endptr, 10);
+    if (!*sep || *endptr || (bits < 0) || (bits > 32))
+      return FALSE;
+    if (!netcat_inet_pton(AF_INET, token, &addr))
+      return FALSE;
+
+    mask = (bits ? (0xFFFFFFFFUL << (32 - bits)) & 0xFFFFFFFFUL : 0);
+    base = ntohl(addr.s_addr) & mask;
+    targets_append(targets, base, base | (~mask & 0xFFFFFFFFUL), NULL);
+    return TRUE;
+  }
+
+  if ((sep = strchr(token, '-'))) {
+    unsigned long first, last;
+    struct in_addr last_addr;
+
+    /* hostnames may contain dashes too, so only treat this as a range if the
+       left part is a valid dotted address */
+    *sep = 0;
+    if (!netcat_inet_pton(AF_INET, token, &addr)) {
+      *sep = '-';
+      goto plain_host;
+    }
+    first = ntohl(addr.s_addr);
+
+    /* the right part is either a complete address or the last octet */
+    if (netcat_inet_pton(AF_INET, sep + 1, &last_addr))
+      last = ntohl(last_addr.s_addr);
+    else {
+      char *endptr;
+      long octet = strtol(sep + 1, &endptr, 10);
+
+      if (!sep[1] || *endptr || (octet < 0) || (octet > 255))
+	return FALSE;
+      last = (first & 0xFFFFFF00UL) | octet;
+    }
+
+    if (last < first)
+      return FALSE;
+    targets_append(targets, first, last, NULL);
+    return TRUE;
+  }
+
+ plain_host:
+  {
+    nc_host_t host;
+
+    if (!netcat_resolvehost(&host, token))
+      return FALSE;
+    netcat_targets_insert(targets, &host);
+  }
+  return TRUE;
+}
+
+/* Returns TRUE if `spec' uses the multiple targets syntax, i.e. it is a
+   comma-separated list, a CIDR block or an address range.  Plain hostnames
+   and addresses (even if they contain dashes) return FALSE. */
+
+bool netcat_targets_isrange(const char *spec)
+{
+  const char *sep;
+  char buf[NETCAT_ADDRSTRLEN];
+  struct in_addr addr;
+
+  if (strchr(spec, ',') || strchr(spec, '/'))
+    return TRUE;
+
+  if (!(sep = strchr(spec, '-')) || (sep - spec >= (int)sizeof(buf)))
+    return FALSE;
+
+  memcpy(buf, spec, sep - spec);
+  buf[sep - spec] = 0;
+  return (netcat_inet_pton(AF_INET, buf, &addr) > 0);
+}
+
+/* Parses the targets specification `spec' and appends the resulting ranges
+   to `targets'.  The specification is a comma-separated list of tokens, each
+   of which may be a CIDR block, an address range or a single host.
+   Returns TRUE on success, FALSE if any of the tokens is invalid. */
+
+bool netcat_targets_parse(nc_targets_t *targets, const char *spec)
+{
+  char *token, *p, *pbuf = strdup(spec);
+  bool ret = TRUE;
+
+  debug_v(("netcat_targets_parse(): spec=\"%s\"", spec));
+
+  /* with the built-in resolver all the hostnames are looked up at the same
+     time first, so the loop below finds them already resolved */
+  if (netcat_dns_enabled() && !opt_numeric) {
+    for (p = pbuf; (token = strsep(&p, ",")); ) {
+      struct in_addr addr;
+
+      if (*token && !netcat_targets_isrange(token) &&
+	  !netcat_inet_pton(AF_INET, token, &addr))
+	netcat_dns_prefetch(token);
+    }
+    netcat_dns_wait();
+    strcpy(pbuf, spec);
+  }
+
+  for (p = pbuf; ret && (token = strsep(&p, ",")); ) {
+    if (!*token)
+      continue;			/* tolerate "a,,b" and trailing commas */
+    ret = targets_parse_token(targets, token);
+  }
+
+  free(pbuf);
+  return ret;
+}
+
+/* Appends the already resolved host `host' to `targets' */
+
+void netcat_targets_insert(nc_targets_t *targets, const nc_host_t *host)
+{
+  targets_append(targets, ntohl(host->host.iaddrs[0].s_addr),
+		 ntohl(host->host.iaddrs[0].s_addr),
+		 (host->host.name[0] ? host->host.name : NULL));
+}
+
+/* Returns the complexive number of addresses included in the various ranges */
+
+unsigned long netcat_targets_count(nc_targets_t targets)
+{
+  nc_targets_t tmp = targets;
+  unsigned long count = 0;
+
+  while (tmp) {
+    count += (tmp->last - tmp->first + 1);
+    tmp = tmp->next;
+  }
+
+  return count;
+}
+
+/* Resets the iterator `pos' to the first address of `targets' */
+
+void netcat_targets_rewind(nc_targets_t targets, nc_targets_pos_t *pos)
+{
+  pos->node = targets;
+  pos->offset = 0;
+}
+
+/* Fetches the address the iterator `pos' points to and advances it.  If
+   `name' is not NULL it is set to the hostname the address was resolved from,
+   or to NULL for addresses coming from ranges.
+   Returns FALSE when the end of the targets list has been reached. */
+
+bool netcat_targets_next(nc_targets_pos_t *pos, struct in_addr *addr,
+			 const char **name)
+{
+  nc_targets_t node = pos->node;
+
+  if (!node)
+    return FALSE;
+
+  addr->s_addr = htonl(node->first + pos->offset);
+  if (name)
+    *name = node->name;
+
+  if (node->first + pos->offset < node->last)
+    pos->offset++;
+  else {
+    pos->node = node->next;
+    pos->offset = 0;
+  }
+
+  return TRUE;
+}
+
+/* Frees all the resources associated with the targets list */
+
+void netcat_targets_free(nc_targets_t targets)
+{
+  while (targets) {
+    nc_targets_t tmp = targets->next;
+
+    free(targets->name);
+    free(targets);
+    targets = tmp;
+  }
+}
@@ -28,7 +28,7 @@
 
 #include "netcat.h"
 
-#ifndef USE_PKTINFO
+#ifndef USE_DSTADDR
 #include <sys/ioctl.h>
 #include <net/if.h>
 #ifdef HAVE_SYS_SOCKIO_H
@@ -60,9 +60,26 @@
 # define ss_family sa_family
 # define lifreq ifreq
 #endif
-#endif	/* !USE_PKTINFO */
+#endif	/* !USE_DSTADDR */
+
+#ifdef USE_DSTADDR
+
+/* Asks the kernel to tell (or, if `enable' is FALSE, to stop telling) the
+   destination address of each datagram received by the socket `sock', which
+   is then found by udphelper_ancillary_read().
+   Returns 0 on success, a negative value otherwise. */
+
+int udphelper_dstaddr(int sock, bool enable)
+{
+  int sockopt = enable;
 
 #ifdef USE_PKTINFO
+  return setsockopt(sock, SOL_IP, IP_PKTINFO, &sockopt, sizeof(sockopt));
+#else
+  return setsockopt(sock, IPPROTO_IP, IP_RECVDSTADDR, &sockopt,
+		    sizeof(sockopt));
+#endif
+}
 
 /* Reads the ancillary data buffer for the given msghdr and extracts the packet
    destination address which is copied to the `get_addr' struct.
@@ -82,7 +99,9 @@ int udphelper_ancillary_read(struct msghdr *my_hdr,
 	 get_cmsg = CMSG_NXTHDR(my_hdr, get_cmsg)) {
       debug_v(("Analizing ancillary header (id=%d)", get_cmsg->cmsg_type));
 
-      if (get_cmsg->cmsg_type == IP_PKTINFO) {
+#ifdef USE_PKTINFO
+      if ((get_cmsg->cmsg_level == SOL_IP) &&
+	  (get_cmsg->cmsg_type == IP_PKTINFO)) {
 	struct in_pktinfo *get_pktinfo;
 
 	/* fetch the data and run away, we don't need to parse everything */
@@ -91,13 +110,83 @@ int udphelper_ancillary_read(struct msghdr *my_hdr,
 	       sizeof(get_addr->sin_addr));
 	return 0;
       }
+#else
+      if ((get_cmsg->cmsg_level == IPPROTO_IP) &&
+	  (get_cmsg->cmsg_type == IP_RECVDSTADDR)) {
+	memcpy(&get_addr->sin_addr, CMSG_DATA(get_cmsg),
+	       sizeof(get_addr->sin_addr));
+	return 0;
+      }
+#endif
     }
   }
 
   return -1;
 }
 
-#else	/* USE_PKTINFO */
+#ifdef USE_SENDSRC
+/* Appends to the ancillary data of the given msghdr the source address
+   `src' of the datagram about to be sent, for a socket bound to any address
+   whose replies must come from the address the peer wrote to.  The buffer
+   pointed by msg_control must have NETCAT_DSTADDR_SPACE more bytes after the
+   msg_controllen already used. */
+
+void udphelper_ancillary_src(struct msghdr *my_hdr, struct in_addr src)
+{
+  struct cmsghdr *put_cmsg;
+
+  put_cmsg = (struct cmsghdr *)((char *)my_hdr->msg_control +
+				my_hdr->msg_controllen);
+  memset(put_cmsg, 0, NETCAT_DSTADDR_SPACE);
+#ifdef USE_PKTINFO
+  {
+    struct in_pktinfo *put_pktinfo;
+
+    put_cmsg->cmsg_level = SOL_IP;
+    put_cmsg->cmsg_type = IP_PKTINFO;
+    put_cmsg->cmsg_len = CMSG_LEN(sizeof(*put_pktinfo));
+    put_pktinfo = (struct in_pktinfo *) CMSG_DATA(put_cmsg);
+    put_pktinfo->ipi_spec_dst = src;
+  }
+#else
+  put_cmsg->cmsg_level = IPPROTO_IP;
+  put_cmsg->cmsg_type = IP_SENDSRCADDR;
+  put_cmsg->cmsg_len = CMSG_LEN(sizeof(src));
+  memcpy(CMSG_DATA(put_cmsg), &src, sizeof(src));
+#endif
+  my_hdr->msg_controllen += NETCAT_DSTADDR_SPACE;
+}
+#endif
+
+#endif	/* USE_DSTADDR */
+
+#ifdef USE_RXQ_OVFL
+
+/* Reads the SO_RXQ_OVFL counter from the ancillary data of the given msghdr.
+   The kernel counts there all the datagrams dropped since the socket was
+   created because its receive queue was full, so the ones dropped since the
+   previous read (whose counter is stored in `last') are added to the
+   stats. */
+
+void udphelper_ancillary_drops(struct msghdr *my_hdr, unsigned int *last)
+{
+  struct cmsghdr *get_cmsg;
+
+  for (get_cmsg = CMSG_FIRSTHDR(my_hdr); get_cmsg;
+       get_cmsg = CMSG_NXTHDR(my_hdr, get_cmsg))
+    if ((get_cmsg->cmsg_level == SOL_SOCKET) &&
+	(get_cmsg->cmsg_type == SO_RXQ_OVFL)) {
+      unsigned int count;
+
+      memcpy(&count, CMSG_DATA(get_cmsg), sizeof(count));
+      dgrams_dropped += count - *last;
+      *last = count;
+    }
+}
+
+#endif	/* USE_RXQ_OVFL */
+
+#ifndef USE_DSTADDR
 
 /* This function opens an array of sockets (stored in `sockbuf'), one for each
    different interface in the current machine.  The purpose of this is to allow
@@ -281,7 +370,7 @@ int udphelper_sockets_open(int **sockbuf, in_port_t nport)
   return -1;
 }
 
-#endif	/* USE_PKTINFO */
+#endif	/* !USE_DSTADDR */
 
 /* Closes the `sockbuf' previously allocated with udphelper_sockets_open().
    The global errno is not altered by this function. */
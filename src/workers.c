@@ -0,0 +1,140 @@
+/*
+ * workers.c -- worker processes sharing the same UDP port
+ * Part of the GNU netcat project
+ */
+
+/***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "netcat.h"
+#include <signal.h>		/* kill() */
+#include <sys/wait.h>		/* waitpid() */
+
+/* Each worker is a process of its own, which runs the listen mode on its own
+   socket bound with SO_REUSEPORT to the same port, and the kernel spreads the
+   peers among them.  When a worker exits it writes its counters to a pipe,
+   and the parent adds them up once all the workers are gone. */
+
+typedef struct {
+  int index;
+  unsigned long bytes_recv;
+  unsigned long bytes_sent;
+  unsigned long dgrams_recv;
+  unsigned long dgrams_dropped;
+} workers_stats_t;
+
+static int workers_fd = -1;	/* write end of the counters pipe */
+static int workers_self = -1;	/* index of this worker */
+static pid_t workers_pid = 0;	/* pid of this worker */
+
+/* Reports the counters of this worker to the parent, at exit */
+
+static void workers_report(void)
+{
+  workers_stats_t stats;
+
+  /* the programs started by the worker inherit the exit handler */
+  if (getpid() != workers_pid)
+    return;
+
+  stats.index = workers_self;
+  stats.bytes_recv = bytes_recv;
+  stats.bytes_sent = bytes_sent;
+  stats.dgrams_recv = dgrams_recv;
+  stats.dgrams_dropped = dgrams_dropped;
+  /* a single write smaller than PIPE_BUF is never mixed with the others */
+  if (write(workers_fd, &stats, sizeof(stats)) < 0) {
+    debug_v(("workers_report(): %s", strerror(errno)));
+  }
+}
+
+/* Starts `count' worker processes.  In each worker this function returns the
+   index of the worker, which then carries on with its job.  In the parent it
+   waits for all the workers to exit (stopping them on SIGINT or SIGTERM),
+   adds their counters up and returns -1. */
+
+int netcat_workers_start(int count)
+{
+  int i, fds[2], alive = 0;
+  pid_t *pids = calloc(count, sizeof(*pids));
+  workers_stats_t stats;
+  bool stopping = FALSE;
+
+  if (pipe(fds) < 0)
+    ncprint(NCPRINT_ERROR | NCPRINT_EXIT, _("Couldn't start the workers: %s"),
+	    strerror(errno));
+
+  for (i = 0; i < count; i++) {
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      ncprint(NCPRINT_WARNING, _("Couldn't start worker %d: %s"), i,
+	      strerror(errno));
+      continue;
+    }
+    if (pids[i] == 0) {
+      free(pids);
+      close(fds[0]);
+      workers_fd = fds[1];
+      workers_self = i;
+      workers_pid = getpid();
+      atexit(workers_report);
+      /* the workers can't share the input, so none of them reads it */
+      close(STDIN_FILENO);
+      use_stdin = FALSE;
+      return i;
+    }
+    alive++;
+  }
+  close(fds[1]);
+  ncprint(NCPRINT_VERB2, _("Started %d workers"), alive);
+
+  /* the workers get the terminal signals on their own, but a signal sent to
+     the parent alone must reach them as well */
+  signal_handler = FALSE;
+  while (alive > 0) {
+    pid_t pid = waitpid(-1, NULL, 0);
+
+    if (pid > 0) {
+      alive--;
+      continue;
+    }
+    if (errno != EINTR)
+      break;
+    if ((got_sigint || got_sigterm) && !stopping) {
+      stopping = TRUE;
+      for (i = 0; i < count; i++)
+	if (pids[i] > 0)
+	  kill(pids[i], SIGTERM);
+    }
+  }
+  got_sigint = got_sigterm = FALSE;
+  signal_handler = TRUE;
+  free(pids);
+
+  while (read(fds[0], &stats, sizeof(stats)) == sizeof(stats)) {
+    ncprint(NCPRINT_VERB2,
+	    _("Worker %d: %lu bytes received, %lu datagrams dropped"),
+	    stats.index, stats.bytes_recv, stats.dgrams_dropped);
+    bytes_recv += stats.bytes_recv;
+    bytes_sent += stats.bytes_sent;
+    dgrams_recv += stats.dgrams_recv;
+    dgrams_dropped += stats.dgrams_dropped;
+  }
+  close(fds[0]);
+  return -1;
+}